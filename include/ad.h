@@ -2,7 +2,10 @@
 #define __AD_H__
 
 #include "vm.h"
+#include "atom.h"
+#include "arena.h"
 #include <stdio.h>
+#include <stdint.h>
 
 /* Domain Analysis */
 
@@ -19,7 +22,33 @@ typedef enum
 	TB_STRUCT
 } TypeBase;
 
-/* the type of a symbol */
+/* the class of a type, which gives its conversions; the base types have the classes with their values */
+typedef enum
+{
+	TC_INT,
+	TC_DOUBLE,
+	TC_CHAR,
+	TC_VOID,
+	TC_ARRAY,
+	TC_STRUCT,
+	TC_COUNT
+} TypeClass;
+
+/*
+	the id of a type from the types table
+	each distinct type is added to the table only once, so two types are the same if their ids are the same
+*/
+typedef uint32_t TypeId;
+
+// the ids of the base types are their TypeBase values
+#define TY_INT		((TypeId) TB_INT)
+#define TY_DOUBLE	((TypeId) TB_DOUBLE)
+#define TY_CHAR		((TypeId) TB_CHAR)
+#define TY_VOID		((TypeId) TB_VOID)
+#define TY_STRING	((TypeId) 4)		// char[], the type of the string constants
+#define TY_NONE		((TypeId) -1)		// not a type, the result of an invalid operation
+
+/* the description of a type, from the types table */
 typedef struct
 {		
 	TypeBase tb;
@@ -32,8 +61,41 @@ typedef struct
 		n>0 - array with specified dimension: double v[10]
 	*/
 	int n;
+	TypeId elem;		// the type of the elements of an array; for the other types, the type itself
+	TypeClass cls;
 } Type;
 
+// the table is made of chunks which are never moved, so a type can be read without a lock while other types are added
+#define TYPE_CHUNK_BITS 8
+#define MAX_TYPE_CHUNKS 4096
+
+extern Type *typeChunks[MAX_TYPE_CHUNKS];
+
+/* returns the description of the type with the given id */
+static inline const Type *typeOf(TypeId id) {
+	return &typeChunks[id >> TYPE_CHUNK_BITS][id & ((1 << TYPE_CHUNK_BITS) - 1)];
+}
+
+/*
+	returns the id of the type with the base tb, the struct s (only for TB_STRUCT) and the dimension n, adding it if it is new
+	it can be called from several threads at once
+*/
+extern TypeId typeIntern(TypeBase tb, Symbol *s, int n);
+
+/* frees the types table; the types handed out before become invalid; no other thread may use types meanwhile */
+extern void freeTypes();
+
+
+/*
+	a call with constant arguments from the code of a function
+	its instructions push the arguments and call the function, without jumps, so they can be replaced with the result
+*/
+typedef struct
+{
+	Instr *first;		// the first instruction of the call: the first argument or the call itself
+	Instr *call;		// the OP_CALL
+	Symbol *fn;			// the called function
+} ConstCall;
 
 /* symbol's kind */
 typedef enum
@@ -46,9 +108,9 @@ typedef enum
 
 struct Symbol
 {
-	const char *name;	// symbol's name. The symbol doesn't own this pointer, but it is allocated somewhere else (ex: in Token)
+	const Atom *name;	// symbol's name, interned in the atoms table
 	SymKind kind;
-	Type type;
+	TypeId type;
 
 	/* 
 		Owner:
@@ -65,64 +127,126 @@ struct Symbol
 		/* 
 			the index in fn.locals for local vars
 			the index in struct for struct members
+			the offset in the data segment of the program for global vars
 		*/
 		int varIdx;
 
-		// the variable memory for global vars (dynamically allocated)
-		void *varMem;
-
 		// the index in fn.params for parameters
 		int paramIdx;
 
-		// the members of a struct
-		Symbol *structMembers;
+		// a struct, with its layout, which is updated as each member is added
+		struct
+		{
+			Symbol **structMembers;	// the members of a struct, in their order, with their offsets in varIdx
+			int nMembers;
+			int capMembers;
+			Symbol **memberIndex;	// a hash table of the members by name, with nMemberSlots slots (a power of 2)
+			int nMemberSlots;
+			int structSize;			// the end of the last member, without the padding at the end of the struct
+			int structAlign;		// the largest alignment of the members
+			Arena memberArena;		// the memory of the members
+		};
 
 		struct
 		{
-			Symbol *params;		// the parameters of a function
-			Symbol *locals;		// all local vars of a function, including the ones from its inner domains
+			Symbol **params;	// the parameters of a function, by paramIdx
+			int nParams;
+			int capParams;
+			Symbol **locals;	// all local vars of a function, including the ones from its inner domains, by varIdx
+			int nLocals;
+			int capLocals;
 			void (*extFnPtr)();	// !=NULL for extern functions
 			Instr *instr;		// used if extFnPtr==NULL
+			ConstCall *constCalls;		// the calls from instr which can be evaluated at compile time, until foldCalls
+			int nConstCalls;
+			bool noEval;		// true if a call of the function could not be evaluated at compile time
+			Arena arena;		// the memory of the parameters and of the local vars
 		} fn;
 	};
 };
 
+/*
+	A domain without a parent is a global domain, which has a hash table of its symbols.
+	The other domains of a thread are all in a single hash table of the thread, the scopes, which has for each
+	name its newest symbol, followed by the symbols which it shadows. The scopes keep the order in which their
+	symbols were added, so a domain drops its symbols from the end of this list.
+	A global domain can be read by many threads, each one with its own domains above it.
+	The memory of the symbols: a global domain has its own arena, which is freed with it; the other domains and
+	their symbols are in a single arena of the thread, used as a stack, so a dropped domain releases them all at once.
+*/
 typedef struct _Domain
 {
 	struct _Domain *parent;	// the parent domain
+	struct _Domain *global;	// the global domain from the bottom of the stack
 	Symbol *symbols;		// the symbols from this domain (single linked list)
+	Symbol *lastSymbol;		// the last one from symbols
+	Symbol **index;			// only for a global domain: its symbols by name, with nSlots slots (a power of 2)
+	int nSlots;
+	int nSymbols;
+	int firstEntry;			// for the other domains: the index of the first symbol of the domain in the scopes
+	Arena arena;			// for a global domain: the memory of its symbols
+	Symbol *spare;			// for a global domain: the symbols freed by freeSymbol, reused by newSymbol
+	ArenaMark mark;			// for the other domains: the memory of the thread before the domain
+	int dataSize;			// for a global domain: the size of the data segment with its global vars
 } Domain;
 
-/* the current domain (the top of the domains's stack) */
-extern Domain *symTable;
+/* the current domain (the top of the domains's stack), for each thread */
+extern _Thread_local Domain *symTable;
 
-/* returns the size of type t in bytes */
-extern int typeSize(Type *t);
+/* returns the size of type t in bytes; a struct is padded at its end to its alignment, so it can be in an array */
+extern int typeSize(TypeId t);
 
-/* dynamic allocation of a new symbol */
-extern Symbol *newSymbol(const char *name, SymKind kind);
+/* returns the alignment of type t in bytes: the size of a base type or the largest alignment of the members of a struct */
+extern int typeAlign(TypeId t);
 
-/* duplicates the given symbol */
-extern Symbol *dupSymbol(Symbol *symbol);
+/* allocates a new symbol in the memory of the domain from the top of the stack, so it is freed with that domain */
+extern Symbol *newSymbol(const Atom *name, SymKind kind);
 
-/* 
-	adds the symbol the the end of the list
-	list - the address of the list where to add the symbol
+/*
+	allocates a new symbol in the memory of owner, which is a struct or a function, so it is freed with it
+	the symbol is a member of the struct or a parameter or a local var of the function
+*/
+extern Symbol *newMember(Symbol *owner, const Atom *name, SymKind kind);
+
+/* adds the parameter p at the end of the parameters of the function fn, sets its index in p->paramIdx and returns it */
+extern Symbol *addParam(Symbol *fn, Symbol *p);
+
+/* adds the local var v at the end of the locals of the function fn, sets its index in v->varIdx and returns it */
+extern Symbol *addLocal(Symbol *fn, Symbol *v);
+
+/*
+	adds the member m at the end of the struct s and returns it
+	its offset is the end of the previous member, aligned for its type, and it is set in m->varIdx
 */
-extern Symbol *addSymbolToList(Symbol **list, Symbol *s);
+extern Symbol *addStructMember(Symbol *s, Symbol *m);
 
-/* the number of the symbols in list */
-extern int symbolsLen(Symbol *list);
+/* returns the member of the struct s with the given name, or NULL if it has no such member */
+extern Symbol *findStructMember(Symbol *s, const Atom *name);
 
-/* frees the memory of a symbol */
-extern void freeSymbol(Symbol *s);
+/* frees the symbol s, which was taken out of the global domain d; its memory is reused by the next symbols of d */
+extern void freeSymbol(Domain *d, Symbol *s);
 
 /* adds a domain to the top of the domains's stack */
 extern Domain *pushDomain(); 
 
-/* deletes the domain from the top of the domains's stack */
+/* deletes the domain from the top of the domains's stack, with all its symbols */
 extern void dropDomain();
 
+/* frees the scopes of this thread; all its domains above the global ones must be dropped */
+extern void freeScopes();
+
+/*
+	takes out of the global domain d the symbols after last (all of them if last is NULL), without freeing them
+	returns their list
+*/
+extern Symbol *cutDomain(Domain *d, Symbol *last);
+
+/* adds the list of symbols at the end of the global domain d */
+extern void appendToDomain(Domain *d, Symbol *list);
+
+/* shows the type t, followed by name if it is not NULL */
+extern void showNamedType(TypeId t, const Atom *name, FILE *stream);
+
 /* shows the content of the given domain */
 extern void showDomain(Domain *d, const char *name, FILE *stream);
 
@@ -130,22 +254,31 @@ extern void showDomain(Domain *d, const char *name, FILE *stream);
 	searches for a symbol with the given name in the specified domain and returns it
 	if no symbol is found, returns NULL
 */
-extern Symbol *findSymbolInDomain(Domain *d, const char *name);
+extern Symbol *findSymbolInDomain(Domain *d, const Atom *name);
 
 /* searches a symbol in all domains, starting with the current one */
-extern Symbol *findSymbol(const char *name);
+extern Symbol *findSymbol(const Atom *name);
 
-/* adds a symbol to the current domain */
+/*
+	adds a symbol to the domain d, which must be a global domain or the top of the domains's stack
+	the parameters and the local vars are added to the domains of their function, without copies
+*/
 extern Symbol *addSymbolToDomain(Domain *d, Symbol *s);
 
+/*
+	gives the global var v a place in the data segment of the global domain d, aligned for its type,
+	and sets its offset in v->varIdx; the places of the vars taken out of d are not reused
+*/
+extern Symbol *addGlobalVar(Domain *d, Symbol *v);
+
 /* add in ST an extern function with the given name, address and return type */
-extern Symbol *addExtFn(const char *name, void (*extFnPtr)(), Type ret);
+extern Symbol *addExtFn(const char *name, void (*extFnPtr)(), TypeId ret);
 
 /* 
 	add to fn a parameter with the given name and type
  	it doesn't verify for parameter redefinition
  	returns the added parameter
 */
-extern Symbol *addFnParam(Symbol *fn, const char *name, Type type);
+extern Symbol *addFnParam(Symbol *fn, const char *name, TypeId type);
 
 #endif
\ No newline at end of file
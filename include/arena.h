@@ -0,0 +1,54 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+/* 
+	Bump allocator
+	The memory is handed out sequentially from big blocks and it is released all at once.
+	The returned pointers remain valid until the arena is freed.
+	The blocks start small and double up to a maximum size, so an arena for a few objects is cheap too.
+	An arena which has all its fields 0 is empty.
+*/
+
+struct ArenaBlock;
+
+typedef struct
+{
+	struct ArenaBlock *blocks;	// the list of allocated blocks, the current one first
+	char *pos;					// the first free byte in the current block
+	char *end;					// the end of the current block
+} Arena;
+
+/* a position in an arena, to release the memory allocated after it */
+typedef struct
+{
+	struct ArenaBlock *block;
+	char *pos;
+} ArenaMark;
+
+/* initializes an empty arena */
+extern void arenaInit(Arena *a);
+
+/* returns nBytes of memory from the arena, aligned for any type */
+extern void *arenaAlloc(Arena *a, size_t nBytes);
+
+/* copies n chars from str into the arena and adds a terminating '\0' */
+extern char *arenaStrndup(Arena *a, const char *str, size_t n);
+
+/* moves all the memory of src into dst, so it is freed with dst; src is left empty */
+extern void arenaMerge(Arena *dst, Arena *src);
+
+/* returns the current position of the arena */
+extern ArenaMark arenaMark(Arena *a);
+
+/*
+	releases the memory allocated after the mark m, like a stack
+	the oldest block of the arena is kept for the next allocations, so a stack which is emptied often does not allocate again
+*/
+extern void arenaRelease(Arena *a, ArenaMark m);
+
+/* frees all the memory of the arena and leaves it empty */
+extern void arenaFree(Arena *a);
+
+#endif
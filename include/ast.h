@@ -0,0 +1,110 @@
+#ifndef __AST_H__
+#define __AST_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "arena.h"
+#include "ad.h"
+
+/*
+	Abstract Syntax Tree
+	The parser builds the tree of the functions, with the types computed by the type analysis.
+	All the nodes are kept in one array and they refer to each other by their index, so the
+	tree is compact, it can be walked without following scattered pointers and it is freed at once.
+*/
+
+/* the index of a node in Ast.nodes; 0 is not a node */
+typedef uint32_t NodeId;
+
+#define NO_NODE 0
+
+/* node's kind */
+typedef enum
+{
+	// expressions: type, lval and ct are from their Ret
+	N_INT,			// i
+	N_DOUBLE,		// d
+	N_CHAR,			// ch
+	N_STRING,		// str
+	N_VAR,			// sym: a global variable, a local variable or a parameter
+	N_CALL,			// sym: the function, a: the first argument
+	N_INDEX,		// a[b]
+	N_FIELD,		// a.sym, sym is the struct member
+	N_NEG,			// -a
+	N_NOT,			// !a
+	N_CAST,			// (type)a
+	N_BINARY,		// a op b, op is the token code of the operator
+	N_ASSIGN,		// a=b
+
+	// statements
+	N_BLOCK,		// a: the first statement
+	N_IF,			// if (a) b else c
+	N_WHILE,		// while (a) b
+	N_RETURN,		// return a;
+	N_EXPR,			// a; (a can be NO_NODE for an empty statement)
+
+	N_FN			// sym: the function, a: its body
+} NodeKind;
+
+typedef struct
+{
+	unsigned char kind;		// N_*
+	unsigned char op;		// the operator of N_BINARY
+	bool lval;				// true if the expression is a left-value
+	bool ct;				// true if the expression is a constant
+	int line;				// the line of the node's first token (the operator for unary and binary nodes)
+	TypeId type;			// the type of an expression
+	NodeId a, b, c;			// the children
+	NodeId next;			// the next node from a list of statements, arguments or functions
+	union
+	{
+		int i;
+		double d;
+		char ch;
+		struct {
+			const char *chars;	// the chars of a string, in Ast.text, followed by '\0'
+			int len;
+		} str;
+
+		/*
+			the symbol used by the node
+			the locals and the parameters are the ones from their function (fn.locals, fn.params),
+			so they stay valid after their domains are dropped
+		*/
+		Symbol *sym;
+	};
+} Node;
+
+typedef struct
+{
+	Node *nodes;		// nodes[0] is not used
+	uint32_t n;			// the number of used entries in nodes
+	uint32_t cap;
+	Arena text;			// the chars of the strings
+	NodeId fns;			// the first function, the next ones are linked by Node.next
+	NodeId lastFn;
+} Ast;
+
+/* initializes an empty tree */
+extern void astInit(Ast *ast);
+
+/* adds a node with all the fields 0 and returns its index; the pointers to nodes are not valid after it */
+extern NodeId astAdd(Ast *ast, NodeKind kind, int line);
+
+/* returns the node with the given index */
+static inline Node *astNode(Ast *ast, NodeId id) {
+	return &ast->nodes[id];
+}
+
+/* removes all the nodes, but keeps their memory for the next ones */
+extern void astClear(Ast *ast);
+
+/* frees all the nodes and leaves the tree empty */
+extern void astFree(Ast *ast);
+
+/* shows the tree, one node per line, with the children indented */
+extern void showAst(Ast *ast, FILE *stream);
+
+#endif
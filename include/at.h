@@ -5,11 +5,27 @@
 
 #include <stdbool.h>
 #include "ad.h"
+#include "ast.h"
+
+/* a value computed at compile time, in the field given by the base type of its expression */
+typedef union
+{
+	int i;
+	double d;
+	char ch;
+} ConstVal;
 
 typedef struct{
-	Type type;		// the returned type
+	TypeId type;	// the returned type
 	bool lval;		// true if left-value
 	bool ct;		// true if constant
+	NodeId node;	// the tree of the expression
+	/*
+		true if the value is known at compile time (a literal or an operation folded from literals)
+		its value is in val and its node is a N_INT, N_DOUBLE or N_CHAR with the same value
+	*/
+	bool known;
+	ConstVal val;
 } Ret;
 
 /* 
@@ -22,7 +38,7 @@ extern bool canBeScalar(Ret* r);
 	verifies if the source type can be converted to the destination type
 	if yes, returns true
 */
-extern bool convTo(Type *src, Type *dst);
+extern bool convTo(TypeId src, TypeId dst);
 
 /* 
 	sets in dst the resulted type of an arithmetic operation
@@ -30,12 +46,6 @@ extern bool convTo(Type *src, Type *dst);
 	returns true if t1 and t2 can be operands for an arithmetic operation
 	ex: double + int -> double
 */
-extern bool arithTypeTo(Type *t1, Type *t2, Type *dst);
-
-/* 
-	searches for a name in a list of symbols
-	if it is found, returns the corresponding symbol, else NULL
-*/
-extern Symbol *findSymbolInList(Symbol *list, const char *name);
+extern bool arithTypeTo(TypeId t1, TypeId t2, TypeId *dst);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef __ATOM_H__
+#define __ATOM_H__
+
+/* 
+	Interned identifiers
+	Each distinct name is stored only once in the atoms table, so two names are equal
+	if and only if their atoms are the same pointer.
+*/
+
+typedef struct Atom
+{
+	const char *text;	// the chars of the name, '\0' terminated
+	int len;			// the number of chars
+	unsigned hash;		// the hash of the chars, computed once
+	struct Atom *next;	// the next atom from the same bucket of the atoms table
+} Atom;
+
+/* 
+	returns the atom of the first len chars from text, adding it to the table if it is new
+	it can be called from several threads at once
+*/
+extern const Atom *atomIntern(const char *text, int len);
+
+/* returns the atom of a '\0' terminated name */
+extern const Atom *atomGet(const char *text);
+
+/* frees all the atoms; the atoms handed out before become invalid; no other thread may intern names meanwhile */
+extern void freeAtoms();
+
+#endif
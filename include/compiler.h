@@ -0,0 +1,148 @@
+#ifndef __COMPILER_H__
+#define __COMPILER_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "utils.h"
+#include "lexer.h"
+#include "parser.h"
+#include "ad.h"
+#include "ast.h"
+#include "vm.h"
+
+struct Compiler;
+typedef struct Compiler Compiler;
+
+/* an error of a compilation or of a run */
+typedef struct
+{
+	const char *file;	// the name of the source file, NULL if it is not known
+	int line;			// the line of the error, 0 if it is not known
+	char *msg;
+} CompileError;
+
+/* a source file of a program */
+typedef struct
+{
+	const char *name;			// the name used in the errors, can be NULL
+	const char *text;			// the content of the file, ending with '\0'
+	Tokens *tokens;				// the tokens of the file, only while it is compiled
+	Declaration *fns;			// the functions declared by the link, whose bodies are parsed after it
+	int nFns;
+	int capFns;
+	CompileError *errors;		// the errors found in the file
+	int nErrors;
+	int capErrors;
+} Unit;
+
+/*
+	the body of a function, built by the threads of compileFiles or, in the lazy mode, on its first call
+	the body of a function from a module has only its text, which is scanned when it is built
+*/
+typedef struct
+{
+	Compiler *c;
+	Unit *u;					// its file; the unit of a module has no text and no tokens
+	Declaration *d;				// its declaration, from u->fns
+	bool failed;				// true if a lazy build found an error in it
+	const char *text;			// the chars of the body, from its "{"
+	int len;
+	int line;					// the line of the "{"
+} FnBody;
+
+/* a module interface imported by importModule */
+typedef struct
+{
+	Unit unit;					// its name is the path of the interface, its fns are the functions of the module
+	FnBody *bodies;
+	int nBodies;
+	void *map;					// the mapping of the interface file, used by the symbols and the bodies
+	size_t size;
+} Module;
+
+/*
+	A compilation of a program, with all its state
+	The compilers do not share any state, so many of them can be used at the same time, each one by a
+	single thread at a time. The errors do not end the program, they are kept in the compiler.
+*/
+struct Compiler
+{
+	Domain *global;				// the global domain: the external functions and the symbols of all the files
+	Unit *units;				// the source files
+	int nUnits;
+	Module **modules;			// the imported modules, in the order of their imports
+	int nModules;
+	Symbol *linked;				// the first symbol added to the global domain by the link of the source files
+	/*
+		if true, compileFiles only links the program and a function body is compiled on the first call of the
+		function or by compileFn, so the time to start a program depends only on the functions which it uses
+		the tokens of the files are kept as long as the compiler
+	*/
+	bool lazy;
+	bool compiled;				// true after the sources were compiled without errors
+	FnBody *bodies;				// the functions of all the files
+	int nBodies;
+	Ast *trees;					// the trees of the functions, one for each thread of the build, kept because the code uses their strings
+	int nTrees;
+	Vm *vm;						// the machine which runs the program
+	CompileError *errors;		// the errors of the last compilation or run, sorted by file
+	int nErrors;
+	int capErrors;
+};
+
+/* creates a compiler which has only the external functions; the programs run by it write to out */
+extern Compiler *newCompiler(FILE *out);
+
+/*
+	compiles the source text, which ends with '\0', and generates the code of its functions, with a thread for each processor
+	returns false if the source has errors, which are kept in errors
+	a compiler compiles a single program
+*/
+extern bool compile(Compiler *c, const char *text);
+
+/*
+	compiles a program made from many source files, with nThreads threads (<=0 for one for each processor):
+	- the files are scanned at the same time
+	- the link adds the declarations of all the files to the global domain, in the order of the files,
+	so a declaration can use only the declarations before it, from its file or from the files before
+	- the bodies of the functions are parsed and generated at the same time, each thread taking the next function
+	from all the files, from the longest one; they can use all the declarations
+	the names and the texts must be kept as long as the compiler; returns false if there are errors
+*/
+extern bool compileFiles(Compiler *c, int nFiles, const char **names, const char **texts, int nThreads);
+
+/*
+	imports the interface of a module from the file at path, written by writeModule: its symbols are added to the global
+	domain without any parsing, so the source files can use them, and the bodies of its functions are compiled
+	lazily, on their first call
+	it must be called before the program is compiled; the modules used by the module must be imported before it
+	the path is the name of the module in the errors, so it must be kept as long as the compiler
+	returns false if the interface cannot be read, if it redefines a symbol or if it needs an extern function
+	which the compiler does not have
+*/
+extern bool importModule(Compiler *c, const char *path);
+
+/*
+	writes to the file at path the interface of the compiled program: its structs, its global variables, its
+	functions with their bodies and the extern functions which it needs; the imported modules are not included
+	returns false if the program is not compiled or the file cannot be written
+*/
+extern bool writeModule(Compiler *c, const char *path);
+
+/*
+	compiles now the body of the function with the given name, if it was not compiled already by the lazy mode
+	returns false if there is no such function or if its body has errors
+*/
+extern bool compileFn(Compiler *c, const char *name);
+
+/*
+	runs the function main of the compiled program; returns false if it cannot be run or it has an error
+	in the lazy mode, the errors of the bodies compiled by the run are also kept in errors
+*/
+extern bool runMain(Compiler *c);
+
+/* frees the compiler with its program */
+extern void freeCompiler(Compiler *c);
+
+#endif
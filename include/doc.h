@@ -0,0 +1,107 @@
+#ifndef __DOC_H__
+#define __DOC_H__
+
+#include <stdbool.h>
+
+#include "lexer.h"
+#include "ad.h"
+#include "ast.h"
+
+/*
+	Incremental analysis of a source edited in an editor
+	A document keeps its tokens and the symbols of its top-level definitions (items) between the edits.
+	After an edit, only the changed lines are scanned again and only the items which contain changed tokens
+	are parsed again. The next items are also parsed again only if the edit changed a global symbol which
+	they could use (a struct, or the name or the signature of a function or global variable).
+	The errors do not end the program, they are kept as diagnostics.
+*/
+
+/* an error from a document */
+typedef struct
+{
+	int line;			// the line of the error, 0 if it is not known
+	const char *msg;	// the error message
+} Diagnostic;
+
+/*
+	a top-level definition of a document
+	the items after the gap of the items have their token indexes from the end of the tokens (negative)
+*/
+typedef struct
+{
+	int firstTk;		// the index of its first token
+	/*
+		the index of the token after it
+		an item with an error ends after its first ";" outside braces or after its first "{...}" (and a ";" after it)
+	*/
+	int endTk;
+	Symbol *symbol;		// the global symbol defined by the item, NULL if none
+	bool failed;		// true if the item has an error, which is in the errors of the document
+} DocItem;
+
+/* the error of an item; after the gap of the errors, tk is from the end of the tokens */
+typedef struct
+{
+	int tk;				// the index of the token of the error
+	char *msg;
+} DocError;
+
+/*
+	The text, the tokens, the items and their errors are kept with a gap at the last edit, so an edit moves
+	or changes only what is between its place and the place of the previous edit. The symbols of the items
+	after the gap are not in the global domain, so the items parsed at the gap see only the symbols before them.
+*/
+typedef struct
+{
+	/*
+		the current text, '\0' terminated, with a gap of gapLen chars at gap, which starts with a '\0'
+		the chars of the text from gap are at the end of the buffer
+	*/
+	char *text;
+	int len;
+	int gap;
+	int gapLen;
+
+	/*
+		the tokens of the text from the last edit without lexical errors
+		the edits made after it (pending) are scanned again with the next edit
+	*/
+	Tokens *tokens;
+	bool pending;
+	int pendingStart;		// the start of the pending changes
+	int pendingOldEnd;		// their end in the text of the tokens
+	int pendingNewEnd;		// their end in the current text
+	char *lexMsg;			// the lexical error of the current text, NULL if none
+	int lexLine;
+
+	Ast ast;				// the tree of the last parsed item, the items keep only their symbols
+	Domain *global;			// the global domain, with the external functions and the symbols of the items before the gap
+	Symbol *builtins;		// the last external function, the items' symbols are after it
+
+	DocItem *items;			// the items, with a gap of capItems-nItems items at itemGap
+	int nItems;
+	int capItems;
+	int itemGap;
+
+	DocError *errors;		// the errors of the items, in the same order, with a gap at the gap of the items
+	int nErrors;
+	int capErrors;
+	int errorGap;
+
+	Diagnostic *diags;		// the diagnostics returned by docDiagnostics
+	int capDiags;
+} Doc;
+
+/* creates a document with the given text and analyzes it */
+extern Doc *docOpen(const char *text, int len);
+
+/* replaces the chars of the document from start to end-1 with len chars from text and updates the analysis */
+extern void docEdit(Doc *doc, int start, int end, const char *text, int len);
+
+/* sets diags to the errors of the document, sorted by line, and returns their number; the work depends only on their number */
+extern int docDiagnostics(Doc *doc, const Diagnostic **diags);
+
+/* frees the document with all its tokens and symbols */
+extern void docClose(Doc *doc);
+
+#endif
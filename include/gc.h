@@ -0,0 +1,45 @@
+#ifndef __GC_H__
+#define __GC_H__
+
+/* Code Generation */
+
+#include "ast.h"
+#include "vm.h"
+
+/*
+	generates the VM code of all the functions from the tree, in their fn.instr
+	the code uses the strings of the tree, so the tree must be kept as long as the code runs
+*/
+extern void genCode(Ast *ast);
+
+/*
+	like genCode, but only for the function with the node id from the tree
+	its calls are evaluated later, by foldCalls
+*/
+extern void genFunction(Ast *ast, NodeId id);
+
+/*
+	evaluates at compile time the calls from the code of f which have only constants as arguments, and replaces
+	each one with its result
+	a call is evaluated on a sandbox VM, with a budget of steps, so the called functions which have side effects
+	(an extern function or a global variable) or which run for too long are left to be called at run time
+	all the functions called by f must be generated; genCode calls it for all its functions
+*/
+extern void foldCalls(Symbol *f);
+
+/*
+	makes the first instruction of the function f, so the other functions can call it before it is generated
+	this way the functions can be generated at the same time by many threads
+*/
+extern void genEntry(Symbol *f);
+
+/*
+	makes the first instruction of the function f an OP_LAZY with the argument lazy, so the VM asks for its code
+	on its first call; the code is generated later, by genFunction, and it starts with the same instruction
+*/
+extern void genLazyEntry(Symbol *f, void *lazy);
+
+/* generates the code which calls the function fn, which has no parameters, and stops the VM after it returns */
+extern Instr *genProgram(Symbol *fn);
+
+#endif
@@ -3,6 +3,9 @@
 
 #include <stdio.h>
 
+#include "arena.h"
+#include "atom.h"
+
 // Token codes
 enum 
 {
@@ -22,21 +25,143 @@ enum
 	ADD, SUB, MUL, DIV, DOT, AND, OR, NOT, ASSIGN, EQUAL, NOTEQ, LESS, LESSEQ, GREATER, GREATEREQ
 };
 
-typedef struct _Token
+// the value of a token
+typedef union
+{
+	const Atom *atom;	// the name for ID
+	struct {
+		/*
+			the chars for STRING, in the text arena if it has escapes
+			NULL for a slice of the source, which starts after the quote of the token (tkStr), so an edit
+			of the source before it does not change it
+		*/
+		const char *chars;
+		int len;			// the number of chars
+	} str;
+	int i;			// the value for INT
+	char c;			// the value for CHAR
+	double d;		// the value for DOUBLE
+} TokenVal;
+
+/*
+	The tokens of a source file, stored as parallel arrays indexed by the token position.
+	All the tokens are released at once by freeTokens.
+
+	A stream of tokens (openTokenStream) scans the tokens on demand and keeps only
+	the tokens from first to n-1 in the arrays, used as a ring: the token idx is
+	at the position (idx & mask). For a fully tokenized source, mask has all the bits set.
+
+	retokenize leaves a gap in the arrays where it changed the tokens: the tokens from gap are after
+	the cap-n free positions and their offsets are from the end of the source (negative), so the next
+	edits before them do not move or change them. The lines have their own gap, in the same way.
+*/
+typedef struct
 {
-	int code;		// ID, TYPE_CHAR, ...
-	int line;		// the line from the input file
-	union {
-		char *text;		// the chars for ID, STRING (dynamically allocated)
-		int i;			// the value for INT
-		char c;			// the value for CHAR
-		double d;		// the value for DOUBLE
-	};
-	struct _Token *next;		// next token in a simple linked list
-} Token;
-
-extern Token *tokenize(const char *pch);
-extern void showTokens(const Token *tokens, FILE *stream);
-extern void freeTokens(Token *tokens);
-
-#endif
\ No newline at end of file
+	int n;					// the number of scanned tokens
+	int cap;				// the capacity of the arrays
+	unsigned mask;			// the mask applied to a token index to get its position in the arrays
+	int first;				// the index of the first token which is still kept
+	int gap;				// the index of the first token after the gap, INT_MAX if the arrays have no gap
+	const char *pch;		// the next char to be scanned, NULL after END
+	unsigned char *codes;	// ID, TYPE_CHAR, ...
+	int *offsets;			// the offset in the source of the token's first char
+	TokenVal *vals;			// the values of the tokens
+	Arena text;				// the chars of the STRING tokens which have escape characters
+
+	/*
+		the source text, used to compute the line of a token and to get the chars of a STRING slice
+		it must stay valid as long as the tokens are used
+		after retokenize, the source can also have a gap, at the gap of the tokens: the chars of the tokens
+		from gap end at srcEnd
+	*/
+	const char *src;
+	const char *srcEnd;		// the final '\0' of the source, set by retokenize
+	int srcLen;				// the number of chars of the source, known after END is scanned
+	int *lineStarts;		// the offset of each line's first char, computed on the first call of tkLine
+	int nLines;
+	int capLines;			// the capacity of lineStarts
+	int lineGap;			// the index of the first line after the gap of lineStarts
+} Tokens;
+
+/* tokenizes the whole source */
+extern Tokens *tokenize(const char *pch);
+
+/*
+	tokenizes the whole source of len chars with up to nThreads threads (0 for one thread per CPU core)
+	the source is split in chunks at newlines, the chunks are tokenized concurrently and their tokens joined in order
+	small sources are tokenized only by the calling thread
+*/
+extern Tokens *tokenizeParallel(const char *pch, size_t len, int nThreads);
+
+/* 
+	creates a stream which scans the tokens only when they are needed
+	the tokens are kept in a ring which grows only when more tokens than its capacity are not released
+*/
+extern Tokens *openTokenStream(const char *pch);
+
+/* scans the next token from the source and returns its index; after END it returns the index of END */
+extern int nextToken(Tokens *tokens);
+
+/*
+	returns the number of chars from p to the end of the lines which are scanned again after an edit
+	which ends at p, or -1 if they go to the end of the source
+*/
+extern int editedLinesEnd(const char *p);
+
+/*
+	updates the tokens of a fully tokenized source after an edit: the chars from start to oldEnd
+	of the old source were replaced, so that in the edited source src they are from start to newEnd
+	only the lines around the edit are scanned again, the next tokens are neither moved nor changed
+	the edited source can have a gap at the end of the edited lines (editedLinesEnd from newEnd), with a '\0'
+	at its start: the chars after the gap are just before srcEnd, the final '\0' of the source
+	the lines of the old source must be known (tkLine) before it is edited; after the call the tokens use src
+	returns the index of the first changed token and sets the number of removed and added tokens
+	on a lexical error the tokens are not changed
+*/
+extern int retokenize(Tokens *tokens, const char *src, const char *srcEnd, int start, int oldEnd, int newEnd, int *nRemoved, int *nAdded);
+
+/* tells a stream that the tokens before idx are not needed anymore */
+extern void tkRelease(Tokens *tokens, int idx);
+
+/* returns the position in the arrays of a scanned token which is still kept */
+static inline int tkPos(Tokens *tokens, int idx) {
+	return (idx < tokens->gap ? idx : idx + tokens->cap - tokens->n) & tokens->mask;
+}
+
+/* returns the code of the token with the given index, scanning it first if needed */
+static inline int tkCode(Tokens *tokens, int idx) {
+	while (idx >= tokens->n) {
+		nextToken(tokens);
+	}
+	return tokens->codes[tkPos(tokens, idx)];
+}
+
+/* returns the value of a scanned token which is still kept */
+static inline TokenVal *tkVal(Tokens *tokens, int idx) {
+	return &tokens->vals[tkPos(tokens, idx)];
+}
+
+/* returns the offset in the source of the first char of a scanned token which is still kept */
+static inline int tkOffset(Tokens *tokens, int idx) {
+	int offset = tokens->offsets[tkPos(tokens, idx)];
+	return idx < tokens->gap ? offset : offset + tokens->srcLen;
+}
+
+/* returns the chars of a scanned STRING token which is still kept */
+static inline const char *tkStr(Tokens *tokens, int idx) {
+	const TokenVal *tk = tkVal(tokens, idx);
+	if (tk->str.chars) {
+		return tk->str.chars;
+	}
+	// a slice starts after the quote
+	int offset = tokens->offsets[tkPos(tokens, idx)] + 1;
+	return idx < tokens->gap ? tokens->src + offset : tokens->srcEnd + offset;
+}
+
+/* returns the line from the input file of the token with the given index */
+extern int tkLine(Tokens *tokens, int idx);
+
+extern void showTokens(Tokens *tokens, FILE *stream);
+extern void freeTokens(Tokens *tokens);
+
+#endif
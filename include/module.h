@@ -0,0 +1,76 @@
+#ifndef __MODULE_H__
+#define __MODULE_H__
+
+/*
+	Module Interfaces
+	An interface file has the declarations of a compiled program, so another program can use them without
+	parsing them again: its structs with their layouts, its global variables, the signatures of its functions
+	with the text of their bodies, and the extern functions which it needs.
+	The file is made of fixed size records, which are used directly from its memory mapping:
+		ModuleHeader
+		ModuleSymbol[nSymbols]	- the symbols, in the order of their definitions
+		ModuleSymbol[nMembers]	- the members of the structs and the parameters of the functions
+		char[textSize]			- the names and the bodies, each one followed by '\0'
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "ad.h"
+
+#define MODULE_MAGIC 0x314d5441		// "ATM1"
+
+// ModuleSymbol.kind of an extern function, which is provided by the compiler which imports the module
+#define MODULE_EXTERN 0xff
+
+typedef struct
+{
+	uint32_t magic;			// MODULE_MAGIC
+	uint32_t nSymbols;
+	uint32_t nMembers;
+	uint32_t textSize;
+} ModuleHeader;
+
+typedef struct
+{
+	uint32_t name;			// the offset of the name in the text
+	uint8_t kind;			// SymKind or MODULE_EXTERN
+	uint8_t tb;				// Type.tb
+	uint16_t unused;
+	int32_t n;				// Type.n
+	uint32_t typeName;		// for TB_STRUCT, the offset of the name of the struct in the text
+	int32_t idx;			// the offset of a struct member or the index of a parameter
+	uint32_t first;			// the index of the first member or parameter
+	uint32_t count;			// the number of members or parameters
+	uint32_t body;			// the offset of the body of a function in the text, from its "{"
+	uint32_t len;			// the number of chars of the body
+	int32_t line;			// the line of the body in its source file
+} ModuleSymbol;
+
+/* a function of a module, with its body */
+typedef struct
+{
+	Symbol *fn;
+	const char *body;		// the chars of the body, from its "{"; when it is read, it ends with '\0'
+	int len;
+	int line;				// the line of the "{" in its source file
+} ModuleFn;
+
+/*
+	writes to out the interface of the symbols from the list all, starting with the symbol from
+	the extern functions from all are written too, as the functions which the module needs
+	fns has the bodies of the functions which are not extern
+	returns false if the file cannot be written
+*/
+extern bool writeInterface(FILE *out, Symbol *all, Symbol *from, ModuleFn *fns, int nFns);
+
+/*
+	adds to the domain d the symbols of the interface from data, which has size bytes and stays valid as long as the symbols
+	the extern functions must already be in d, with the same signatures
+	returns the number of the functions which are not extern and sets in *fns their bodies, which point inside data
+	stops with an error if the interface is not valid or if it redefines a symbol
+*/
+extern int readInterface(const void *data, size_t size, Domain *d, ModuleFn **fns);
+
+#endif
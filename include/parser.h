@@ -2,7 +2,51 @@
 #define __PARSER_H__
 
 #include "lexer.h"
+#include "ast.h"
 
-extern void parse(Token *tokens);
+/* parses all the tokens and adds the functions to the tree */
+extern void parse(Tokens *tokens, Ast *ast);
+
+/*
+	parses only the top-level definition (struct, function or global variable) which starts at the token idx
+	its symbol is added to the current domain and a function is added to the tree
+	returns the index of the token after the definition; at END nothing is parsed and idx is returned
+*/
+extern int parseTopLevel(Tokens *tokens, int idx, Ast *ast);
+
+/* a function whose body was skipped by parseDeclaration */
+typedef struct
+{
+	Symbol *fn;			// the function, NULL if the definition is not a function
+	int line;			// the line of the function's name
+	int bodyTk;			// the index of the "{" which starts the body
+	int endTk;			// the index of the token after the body
+} Declaration;
+
+/*
+	like parseTopLevel, but it parses only the declaration: a struct, a global variable or the signature of a function
+	the body of a function is skipped and saved in decl, so it can be parsed later with parseFnBody, when the
+	current domain can have more symbols
+*/
+extern int parseDeclaration(Tokens *tokens, int idx, Declaration *decl);
+
+/*
+	parses the body of the function from decl and adds the function to the tree; returns its node
+	the bodies of the same tokens can be parsed at the same time by many threads, each one with its own tree
+*/
+extern NodeId parseFnBody(Tokens *tokens, Declaration *decl, Ast *ast);
+
+/*
+	returns the index of the token after the top-level definition which starts at the token idx, found only from the tokens:
+	after its first ";" outside braces or after its first "{...}" (and a ";" after it)
+	it is used to go on after a definition with an error
+*/
+extern int skipTopLevel(Tokens *tokens, int idx);
+
+/* frees the memory which the parser of the calling thread keeps between the calls of parseTopLevel */
+extern void parseEnd();
+
+/* returns the index of the token where the last error was found */
+extern int parseErrorTk();
 
 #endif
\ No newline at end of file
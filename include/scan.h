@@ -0,0 +1,50 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+/*
+	Scanning kernels for the lexer's hot loops
+	Each kernel receives a pointer into a '\0' terminated text and returns a pointer
+	to the first char which does not belong to the scanned run ('\0' always ends a run).
+	The SIMD kernels read whole aligned blocks, so they never cross into a page
+	which does not contain chars of the text.
+*/
+
+#include <stdbool.h>
+
+// the kinds of runs
+enum
+{
+	SKIP_NONE,		// no kernel
+	SKIP_BLANKS,	// ' ', '\t', '\r', '\n'
+	SKIP_ID,		// letters, digits and '_'
+	SKIP_DIGITS,	// '0'...'9'
+	SKIP_COMMENT,	// anything except '\r', '\n'
+	SKIP_STRING,	// anything except '"', '\\', '\r', '\n'
+	NUM_SKIPS
+};
+
+// the kernels implementations
+typedef enum
+{
+	SCAN_SCALAR,
+	SCAN_SSE2,
+	SCAN_AVX2
+} ScanLevel;
+
+typedef const char *(*ScanFn)(const char *p);
+
+/* the selected kernel for each kind of run, indexed by SKIP_* */
+extern ScanFn scanSkip[NUM_SKIPS];
+
+/* selects the best kernels supported by the CPU (CPUID), if no kernels were selected yet */
+extern ScanLevel scanInit();
+
+/* returns true if the CPU supports the given kernels */
+extern bool scanSupported(ScanLevel level);
+
+/* selects the given kernels, which must be supported; used by benchmarks */
+extern void scanUse(ScanLevel level);
+
+extern const char *scanLevelName(ScanLevel level);
+
+#endif
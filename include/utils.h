@@ -1,15 +1,63 @@
-#ifndef __UTISL_H__
+#ifndef __UTILS_H__
 #define __UTILS_H__
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <stdnoreturn.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <setjmp.h>
+
+#define ERR_MSG_SIZE 512
+
+/*
+	a point where the errors go back to, instead of ending the program
+	while errTrap is set, the errors save their message and line in it and jump to env
+	each thread has its own errTrap
+*/
+typedef struct
+{
+	jmp_buf env;
+	int line;				// the line of the error in the source, 0 if it is not known
+	char msg[ERR_MSG_SIZE];	// the error message, without the "Error" prefix
+} ErrTrap;
+
+extern _Thread_local ErrTrap *errTrap;
 
 extern noreturn void err(const char *fmt, ...);
 
+/* like err, for an error from the given line of the source, which is already in the message */
+extern noreturn void errLine(int line, const char *fmt, ...);
+
+/* reports an error from the given line of the source as "Error at line <line>: <message>" */
+extern noreturn void verrAt(int line, const char *fmt, va_list va);
+
+/* sends the error caught by trap on to the current errTrap, after trap was used to free some memory */
+extern noreturn void errRethrow(ErrTrap *trap);
+
 extern void *safeAlloc(size_t nBytes);
 
-extern char *loadFile(const char *fileName);
+extern void *safeRealloc(void *p, size_t nBytes);
+
+/* 
+	a source file loaded in memory
+	the content is followed by a '\0', so it can be used as a string
+*/
+typedef struct
+{
+	const char *text;	// the content of the file
+	size_t len;			// the number of chars, without the final '\0'
+	bool mapped;		// true if text is a read-only memory mapping of the file, else it is allocated
+	size_t mapLen;		// the length of the mapping
+} Source;
+
+/* 
+	loads a file, mapping it in memory when possible
+	the source must stay alive as long as its text is used (ex: by the tokens)
+*/
+extern Source *loadSource(const char *fileName);
+
+extern void freeSource(Source *src);
 
 extern FILE *createOutputStream(const char *fileName);
 
@@ -1,6 +1,9 @@
 #ifndef __VM_H__
 #define __VM_H__
 
+#include <stdbool.h>
+#include <stdio.h>
+
 // stack based virtual machine
 
 // the instructions of the virtual machine
@@ -51,6 +54,82 @@ typedef enum
 	OP_LESS_F
 	,
 	OP_ADD_F
+	,
+	OP_SUB_I // subtracts the int value from stack from the int value before it and puts the result on stack
+	,
+	OP_SUB_F
+	,
+	OP_MUL_I // multiplies 2 int values from stack and puts the result on stack
+	,
+	OP_MUL_F
+	,
+	OP_DIV_I // divides the int value before the stack value by the stack value and puts the result on stack
+	,
+	OP_DIV_F
+	,
+	OP_NEG_I // replaces the int value from stack with its negation
+	,
+	OP_NEG_F
+	,
+	OP_NOT_I // replaces the int value from stack with 1 if it is 0, else with 0
+	,
+	OP_NOT_F // replaces the double value from stack with the int 1 if it is 0, else with 0
+	,
+	OP_EQUAL_I // compares 2 int values from stack and puts the result on stack as int
+	,
+	OP_EQUAL_F
+	,
+	OP_NOTEQ_I
+	,
+	OP_NOTEQ_F
+	,
+	OP_LESSEQ_I
+	,
+	OP_LESSEQ_F
+	,
+	OP_GREATER_I
+	,
+	OP_GREATER_F
+	,
+	OP_GREATEREQ_I
+	,
+	OP_GREATEREQ_F
+	,
+	OP_CONV_F_I // converts the stack value from double to int
+	,
+	OP_CONV_I_C // converts the stack value from int to char, kept as an int
+	,
+	OP_FPADDR // [idx] puts on stack the address of FP[idx]
+	,
+	OP_ADDR // [addr] puts on stack the given address
+	,
+	OP_GADDR // [offset] puts on stack the address of the given offset in the data segment of the global vars
+	,
+	OP_LOAD_I // replaces the address from stack with the int value from it
+	,
+	OP_LOAD_F // replaces the address from stack with the double value from it
+	,
+	OP_LOAD_C // replaces the address from stack with the char value from it, as an int
+	,
+	OP_STORE_I // pops an address and an int value and stores the value at the address
+	,
+	OP_STORE_F // pops an address and a double value and stores the value at the address
+	,
+	OP_STORE_C // pops an address and an int value and stores it as a char at the address
+	,
+	OP_STORE_S // [size] pops the destination address and the source address and copies size bytes between them
+	,
+	OP_INDEX // [size] pops an int index and an address and puts on stack address+index*size
+	,
+	OP_OFFSET // [offset] adds the given number of bytes to the address from stack
+	,
+	OP_COPY // [size] replaces the address from stack with the size bytes from it, in as many cells as they need
+	,
+	OP_DUP // puts on stack a copy of the stack value
+	,
+	OP_DROP // removes the stack value
+	,
+	OP_LAZY // [fn] generates the code of the function which starts with this instruction (Vm.genLazy), then runs it
 
 } Opcode;
 
@@ -82,6 +161,9 @@ extern Instr *addInstr(Instr **list, Opcode op);
 // returns the newly added instruction
 extern Instr *insertInstr(Instr *before, int op);
 
+// deletes all the instructions from the list
+extern void freeInstrs(Instr *list);
+
 // deletes all the instructions after the given one
 extern void delInstrAfter(Instr *instr);
 
@@ -94,11 +176,48 @@ extern Instr *addInstrWithInt(Instr **list, Opcode op, int argVal);
 // add an instruction which has an argument of type double
 extern Instr *addInstrWithDouble(Instr **list, Opcode op, double argVal);
 
-// MV initialisation
+#define MAXSTACK 10000
+
+// the state of a virtual machine
+// each machine is used by a single thread at a time, so many programs can run at the same time
+typedef struct
+{
+	Val stack[MAXSTACK];	// the stack
+	Val *SP;				// Stack pointer - points to the value from the top of the stack, stack-1 if it is empty
+	Val *FP;				// Frame pointer - points to the frame of the current function
+	bool trace;				// if true, run shows each executed instruction and the stack size before it
+	FILE *out;				// the output of the program and of the trace
+	/*
+		if true, the code can use only the stack: run stops with an error at an extern function (OP_CALL_EXT)
+		or at an address from outside the stack (OP_ADDR, OP_GADDR), so the code cannot have side effects
+	*/
+	bool sandbox;
+	int budget;				// if >0, run stops with an error after this number of calls and jumps
+	/*
+		called by OP_LAZY with its argument, to generate the code of a function on its first call
+		it makes the OP_LAZY the OP_ENTER of the function or it stops with an error; NULL if the machine cannot generate code
+	*/
+	void (*genLazy)(void *fn);
+	char *globals;			// the data segment with all the global vars, each one at its offset, NULL until vmGlobals
+	int globalsSize;
+} Vm;
+
+// creates a machine with an empty stack, without trace, sandbox or budget, which writes to out
+extern Vm *newVm(FILE *out);
+
+extern void freeVm(Vm *vm);
+
+/*
+	gives the machine a data segment of size bytes for the global vars, aligned to a cache line and filled with 0
+	the segment is a single block, so all the state of the globals can be copied or reset at once
+*/
+extern void vmGlobals(Vm *vm, int size);
+
+// MV initialisation: adds the extern functions to the current domain
 extern void vmInit();
 
-// executes the code starting with the given instruction (IP - Instruction Pointer)
-extern void run(Instr *IP);
+// executes on the machine vm the code starting with the given instruction (IP - Instruction Pointer)
+extern void run(Vm *vm, Instr *IP);
 
 // generates a test program
 extern Instr *genTestProgram();
@@ -4,10 +4,149 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
-Domain *symTable = NULL;
+#define TYPE_CHUNK (1 << TYPE_CHUNK_BITS)
+#define NUM_FIXED_TYPES 5
+#define INITIAL_TYPE_SLOTS 1024
 
-int typeBaseSize(Type *t) {
+#define INITIAL_SCOPE_SLOTS 64
+
+_Thread_local Domain *symTable = NULL;
+
+// a symbol from a domain which is not global
+typedef struct
+{
+	Symbol *s;
+	Domain *d;
+	int shadowed;		// the index of the entry with the symbol shadowed by s, -1 if there is none
+} ScopeEntry;
+
+// a name from the scopes, with the index of its newest entry, -1 if it has no symbol now
+typedef struct
+{
+	const Atom *name;
+	int entry;
+} ScopeSlot;
+
+/*
+	The scopes of a thread: the symbols of its domains above the global ones, in the order of their additions,
+	and a hash table of their names. The names stay in the table after their symbols are dropped, so the table
+	has no deletions; it has only the names used by the thread.
+*/
+static _Thread_local ScopeEntry *entries;
+static _Thread_local int nEntries;
+static _Thread_local int capEntries;
+static _Thread_local ScopeSlot *scopeSlots;
+static _Thread_local int nScopeSlots;	// a power of 2, with at most half of its slots used
+static _Thread_local int nScopeNames;
+static _Thread_local Arena scopeArena;	// the memory of the domains above the global ones, with their symbols
+
+// adds s to the hash table index, which has n symbols, doubling its slots if needed
+static void indexAdd(Symbol ***index, int *nSlots, int n, Symbol *s);
+static Symbol *indexFind(Symbol **index, int nSlots, const Atom *name);
+static void indexRemove(Symbol **index, int nSlots, Symbol *s);
+// returns the slot of the name in the scopes, adding it if it is new
+static ScopeSlot *scopeSlot(const Atom *name);
+// frees what the symbol s has, but not the symbol, which is in an arena
+static void releaseSymbol(Symbol *s);
+// the arena of a struct or of a function
+static Arena *ownerArena(Symbol *owner);
+// adds s at the end of the array, which has n symbols and room for cap, and returns its index
+static int addToArray(Symbol ***array, int *n, int *cap, Symbol *s);
+
+// the first chunk has the types with fixed ids, which are not in typeSlots, except TY_STRING
+static Type fixedTypes[TYPE_CHUNK] = {
+	{ TB_INT, NULL, -1, TY_INT, TC_INT },
+	{ TB_DOUBLE, NULL, -1, TY_DOUBLE, TC_DOUBLE },
+	{ TB_CHAR, NULL, -1, TY_CHAR, TC_CHAR },
+	{ TB_VOID, NULL, -1, TY_VOID, TC_VOID },
+	{ TB_CHAR, NULL, 0, TY_CHAR, TC_ARRAY }		// TY_STRING
+};
+Type *typeChunks[MAX_TYPE_CHUNKS] = { fixedTypes };
+static unsigned numTypes = NUM_FIXED_TYPES;
+static TypeId *typeSlots = NULL;	// a hash table with the ids of the types, each one +1, so 0 is a free slot
+static unsigned numTypeSlots = 0;	// always a power of 2, with at most half of its slots used
+static pthread_mutex_t typesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned hashType(TypeBase tb, Symbol *s, int n) {
+	unsigned h = (unsigned) ((uintptr_t) s >> 4) * 2654435761u;
+	return (h ^ (unsigned) tb * 40503u) + (unsigned) n * 97u;
+}
+
+// adds the id to typeSlots; the caller holds typesLock
+static void addTypeSlot(TypeId id) {
+	const Type *t = typeOf(id);
+	unsigned k = hashType(t->tb, t->s, t->n) & (numTypeSlots - 1);
+	for (; typeSlots[k]; k = (k + 1) & (numTypeSlots - 1)) {
+	}
+	typeSlots[k] = id + 1;
+}
+
+TypeId typeIntern(TypeBase tb, Symbol *s, int n) {
+	if (n < 0 && tb != TB_STRUCT) {
+		return (TypeId) tb;
+	}
+	if (n < 0) {
+		n = -1;
+	}
+	if (tb != TB_STRUCT) {
+		s = NULL;
+	}
+	// the type of the elements is added first, so the lock is not taken again
+	TypeId elem = n >= 0 ? typeIntern(tb, s, -1) : TY_NONE;
+	pthread_mutex_lock(&typesLock);
+	if (!typeSlots) {
+		numTypeSlots = INITIAL_TYPE_SLOTS;
+		typeSlots = (TypeId*) safeAlloc(numTypeSlots * sizeof(TypeId));
+		memset(typeSlots, 0, numTypeSlots * sizeof(TypeId));
+		addTypeSlot(TY_STRING);
+	}
+	unsigned k = hashType(tb, s, n) & (numTypeSlots - 1);
+	for (; typeSlots[k]; k = (k + 1) & (numTypeSlots - 1)) {
+		const Type *t = typeOf(typeSlots[k] - 1);
+		if (t->tb == tb && t->s == s && t->n == n) {
+			pthread_mutex_unlock(&typesLock);
+			return typeSlots[k] - 1;
+		}
+	}
+	if (numTypes == MAX_TYPE_CHUNKS * TYPE_CHUNK) {
+		pthread_mutex_unlock(&typesLock);
+		err("Too many types");
+	}
+	TypeId id = numTypes;
+	if (!typeChunks[id >> TYPE_CHUNK_BITS]) {
+		typeChunks[id >> TYPE_CHUNK_BITS] = (Type*) safeAlloc(TYPE_CHUNK * sizeof(Type));
+	}
+	typeChunks[id >> TYPE_CHUNK_BITS][id & (TYPE_CHUNK - 1)] = (Type) { tb, s, n, n >= 0 ? elem : id, n >= 0 ? TC_ARRAY : TC_STRUCT };
+	numTypes++;
+	if (2 * (numTypes - NUM_FIXED_TYPES + 1) > numTypeSlots) {
+		free(typeSlots);
+		numTypeSlots *= 2;
+		typeSlots = (TypeId*) safeAlloc(numTypeSlots * sizeof(TypeId));
+		memset(typeSlots, 0, numTypeSlots * sizeof(TypeId));
+		for (TypeId i = TY_STRING; i < numTypes; ++i) {
+			addTypeSlot(i);
+		}
+	} else {
+		addTypeSlot(id);
+	}
+	pthread_mutex_unlock(&typesLock);
+	return id;
+}
+
+void freeTypes() {
+	for (int i = 1; i < MAX_TYPE_CHUNKS && typeChunks[i]; ++i) {
+		free(typeChunks[i]);
+		typeChunks[i] = NULL;
+	}
+	free(typeSlots);
+	typeSlots = NULL;
+	numTypeSlots = 0;
+	numTypes = NUM_FIXED_TYPES;
+}
+
+int typeBaseSize(const Type *t) {
 	switch (t->tb) {
 		case TB_INT:
 			return sizeof(int);
@@ -18,16 +157,15 @@ int typeBaseSize(Type *t) {
 		case TB_VOID:
 			return 0;
 		default: {	// TB_STRUCT
-			int size = 0;
-			for (Symbol *m = t->s->structMembers; m; m = m->next) {
-				size += typeSize(&m->type);
-			}
-			return size;
+			// the layout is computed when the members are added
+			int align = t->s->structAlign ? t->s->structAlign : 1;
+			return (t->s->structSize + align - 1) / align * align;
 		}
 	}
 }
 
-int typeSize(Type *t) {
+int typeSize(TypeId id) {
+	const Type *t = typeOf(id);
 	if (t->n < 0) {
 		return typeBaseSize(t);
 	}
@@ -37,16 +175,32 @@ int typeSize(Type *t) {
 	return t->n * typeBaseSize(t);
 }
 
-// free from memory a list of symbols
-void freeSymbols(Symbol *list) {
-	for (Symbol *next; list; list = next) {
-		next = list->next;
-		freeSymbol(list);
+int typeAlign(TypeId id) {
+	const Type *t = typeOf(id);
+	if (t->n == 0) {
+		return _Alignof(void*);
+	}
+	switch (t->tb) {
+		case TB_INT:
+			return _Alignof(int);
+		case TB_DOUBLE:
+			return _Alignof(double);
+		case TB_STRUCT:
+			return t->s->structAlign ? t->s->structAlign : 1;
+		default:	// TB_CHAR, TB_VOID
+			return 1;
 	}
 }
 
-Symbol *newSymbol(const char *name, SymKind kind) {
-	Symbol *s = (Symbol*) safeAlloc(sizeof(Symbol));
+Symbol *newSymbol(const Atom *name, SymKind kind) {
+	Domain *d = symTable;
+	Symbol *s;
+	if (d->spare) {
+		s = d->spare;
+		d->spare = s->next;
+	} else {
+		s = (Symbol*) arenaAlloc(d->parent ? &scopeArena : &d->arena, sizeof(Symbol));
+	}
 	// sets all the fields to 0/NULL
 	memset(s, 0, sizeof(Symbol));
 	s->name = name;
@@ -54,56 +208,150 @@ Symbol *newSymbol(const char *name, SymKind kind) {
 	return s;
 }
 
-Symbol *dupSymbol(Symbol *symbol) {
-	Symbol *s = (Symbol*) safeAlloc(sizeof(Symbol));
-	*s = *symbol;
-	s->next = NULL;
+Symbol *newMember(Symbol *owner, const Atom *name, SymKind kind) {
+	Symbol *s = (Symbol*) arenaAlloc(ownerArena(owner), sizeof(Symbol));
+	memset(s, 0, sizeof(Symbol));
+	s->name = name;
+	s->kind = kind;
+	s->owner = owner;
 	return s;
 }
 
-// s->next is already NULL from newSymbol
-Symbol *addSymbolToList(Symbol **list, Symbol *s) {
-	Symbol *iter = *list;
-	if (iter) {
-		while (iter->next) {
-			iter = iter->next;
+Arena *ownerArena(Symbol *owner) {
+	return owner->kind == SK_STRUCT ? &owner->memberArena : &owner->fn.arena;
+}
+
+int addToArray(Symbol ***array, int *n, int *cap, Symbol *s) {
+	if (*n == *cap) {
+		*cap = *cap ? *cap * 2 : 4;
+		*array = safeRealloc(*array, *cap * sizeof(Symbol*));
+	}
+	(*array)[*n] = s;
+	return (*n)++;
+}
+
+Symbol *addParam(Symbol *fn, Symbol *p) {
+	p->paramIdx = addToArray(&fn->fn.params, &fn->fn.nParams, &fn->fn.capParams, p);
+	return p;
+}
+
+Symbol *addLocal(Symbol *fn, Symbol *v) {
+	v->varIdx = addToArray(&fn->fn.locals, &fn->fn.nLocals, &fn->fn.capLocals, v);
+	return v;
+}
+
+Symbol *addStructMember(Symbol *s, Symbol *m) {
+	int align = typeAlign(m->type);
+	m->varIdx = (s->structSize + align - 1) / align * align;
+	s->structSize = m->varIdx + typeSize(m->type);
+	if (align > s->structAlign) {
+		s->structAlign = align;
+	}
+	indexAdd(&s->memberIndex, &s->nMemberSlots, s->nMembers, m);
+	addToArray(&s->structMembers, &s->nMembers, &s->capMembers, m);
+	return m;
+}
+
+Symbol *findStructMember(Symbol *s, const Atom *name) {
+	return indexFind(s->memberIndex, s->nMemberSlots, name);
+}
+
+void indexAdd(Symbol ***index, int *nSlots, int n, Symbol *s) {
+	// the index has at most half of its slots used
+	if (2 * (n + 1) > *nSlots) {
+		int nNew = *nSlots ? *nSlots * 2 : 8;
+		Symbol **slots = (Symbol**) safeAlloc(nNew * sizeof(Symbol*));
+		memset(slots, 0, nNew * sizeof(Symbol*));
+		for (int i = 0; i < *nSlots; ++i) {
+			Symbol *old = (*index)[i];
+			if (old) {
+				unsigned k = old->name->hash & (nNew - 1);
+				for (; slots[k]; k = (k + 1) & (nNew - 1)) {
+				}
+				slots[k] = old;
+			}
 		}
-		iter->next = s;
-	} else {
-		*list = s;
+		free(*index);
+		*index = slots;
+		*nSlots = nNew;
 	}
-	return s;
+	unsigned k = s->name->hash & (*nSlots - 1);
+	for (; (*index)[k]; k = (k + 1) & (*nSlots - 1)) {
+	}
+	(*index)[k] = s;
+}
+
+Symbol *indexFind(Symbol **index, int nSlots, const Atom *name) {
+	if (!nSlots) {
+		return NULL;
+	}
+	for (unsigned k = name->hash & (nSlots - 1); index[k]; k = (k + 1) & (nSlots - 1)) {
+		if (index[k]->name == name) {
+			return index[k];
+		}
+	}
+	return NULL;
+}
+
+void indexRemove(Symbol **index, int nSlots, Symbol *s) {
+	unsigned mask = nSlots - 1;
+	unsigned i = s->name->hash & mask;
+	while (index[i] != s) {
+		i = (i + 1) & mask;
+	}
+	// the next symbols of the cluster are moved back, so no symbol is after a free slot from its first slot
+	for (unsigned j = (i + 1) & mask; index[j]; j = (j + 1) & mask) {
+		unsigned k = index[j]->name->hash & mask;
+		if (((j - k) & mask) >= ((j - i) & mask)) {
+			index[i] = index[j];
+			i = j;
+		}
+	}
+	index[i] = NULL;
 }
 
-int symbolsLen(Symbol *list) {
-	int n = 0;
-	for (; list; list = list->next) n++;
-	return n;
+void freeSymbol(Domain *d, Symbol *s) {
+	releaseSymbol(s);
+	s->next = d->spare;
+	d->spare = s;
 }
 
-void freeSymbol(Symbol *s) {
+void releaseSymbol(Symbol *s) {
 	switch (s->kind) {
-		case SK_VAR:
-			if (!s->owner)
-				free(s->varMem);
-			break;
 		case SK_FN:
-			freeSymbols(s->fn.params);
-			freeSymbols(s->fn.locals);
+			// the parameters and the local vars have nothing else to free
+			arenaFree(&s->fn.arena);
+			free(s->fn.params);
+			free(s->fn.locals);
+			if (s->fn.instr) {
+				freeInstrs(s->fn.instr);
+			}
+			free(s->fn.constCalls);
 			break;
 		case SK_STRUCT:
-			freeSymbols(s->structMembers);
+			arenaFree(&s->memberArena);
+			free(s->structMembers);
+			free(s->memberIndex);
 			break;
-		case SK_PARAM:
+		default:	// SK_VAR, SK_PARAM
 			break;
 	}
-	free(s);
 }
 
 Domain *pushDomain() {
-	Domain *d = (Domain*) safeAlloc(sizeof(Domain));
-	d->symbols = NULL;
+	Domain *d;
+	if (symTable) {
+		ArenaMark mark = arenaMark(&scopeArena);
+		d = (Domain*) arenaAlloc(&scopeArena, sizeof(Domain));
+		memset(d, 0, sizeof(Domain));
+		d->mark = mark;
+	} else {
+		d = (Domain*) safeAlloc(sizeof(Domain));
+		memset(d, 0, sizeof(Domain));
+	}
 	d->parent = symTable;
+	d->global = symTable ? symTable->global : d;
+	d->firstEntry = nEntries;
 	symTable = d;
 	return d;
 }
@@ -111,20 +359,96 @@ Domain *pushDomain() {
 void dropDomain() {
 	Domain *d = symTable;
 	symTable = d->parent;
-	freeSymbols(d->symbols);
+	if (d->parent) {
+		// the names shadowed by the symbols of the domain are visible again
+		while (nEntries > d->firstEntry) {
+			ScopeEntry *e = &entries[--nEntries];
+			scopeSlot(e->s->name)->entry = e->shadowed;
+		}
+		// the symbols of the domain are local vars, parameters or struct members, which have nothing else to free
+		arenaRelease(&scopeArena, d->mark);
+		return;
+	}
+	for (Symbol *s = d->symbols; s; s = s->next) {
+		releaseSymbol(s);
+	}
+	arenaFree(&d->arena);
+	free(d->index);
 	free(d);
 }
 
-void showNamedType(Type *t, const char *name, FILE *stream) {
+void freeScopes() {
+	free(entries);
+	entries = NULL;
+	nEntries = capEntries = 0;
+	free(scopeSlots);
+	scopeSlots = NULL;
+	nScopeSlots = nScopeNames = 0;
+	arenaFree(&scopeArena);
+}
+
+Symbol *cutDomain(Domain *d, Symbol *last) {
+	Symbol *list = last ? last->next : d->symbols;
+	for (Symbol *s = list; s; s = s->next) {
+		indexRemove(d->index, d->nSlots, s);
+		d->nSymbols--;
+	}
+	if (last) {
+		last->next = NULL;
+	} else {
+		d->symbols = NULL;
+	}
+	d->lastSymbol = last;
+	return list;
+}
+
+void appendToDomain(Domain *d, Symbol *list) {
+	for (Symbol *next; list; list = next) {
+		next = list->next;
+		addSymbolToDomain(d, list);
+	}
+}
+
+ScopeSlot *scopeSlot(const Atom *name) {
+	if (2 * (nScopeNames + 1) > nScopeSlots) {
+		int n = nScopeSlots ? nScopeSlots * 2 : INITIAL_SCOPE_SLOTS;
+		ScopeSlot *slots = (ScopeSlot*) safeAlloc(n * sizeof(ScopeSlot));
+		memset(slots, 0, n * sizeof(ScopeSlot));
+		for (int i = 0; i < nScopeSlots; ++i) {
+			if (scopeSlots[i].name) {
+				unsigned k = scopeSlots[i].name->hash & (n - 1);
+				for (; slots[k].name; k = (k + 1) & (n - 1)) {
+				}
+				slots[k] = scopeSlots[i];
+			}
+		}
+		free(scopeSlots);
+		scopeSlots = slots;
+		nScopeSlots = n;
+	}
+	unsigned k = name->hash & (nScopeSlots - 1);
+	for (; scopeSlots[k].name; k = (k + 1) & (nScopeSlots - 1)) {
+		if (scopeSlots[k].name == name) {
+			return &scopeSlots[k];
+		}
+	}
+	scopeSlots[k].name = name;
+	scopeSlots[k].entry = -1;
+	nScopeNames++;
+	return &scopeSlots[k];
+}
+
+void showNamedType(TypeId id, const Atom *name, FILE *stream) {
+	const Type *t = typeOf(id);
 	switch (t->tb) {
 		case TB_INT:			fprintf(stream, "int"); break;
 		case TB_DOUBLE:			fprintf(stream, "double"); break;
 		case TB_CHAR:			fprintf(stream, "char"); break;
 		case TB_VOID:			fprintf(stream, "void"); break;
-		default:/*TB_STRUCT*/	fprintf(stream, "struct %s",t->s->name);
+		default:/*TB_STRUCT*/	fprintf(stream, "struct %s",t->s->name->text);
 	}
 	if (name) {
-		fprintf(stream, " %s", name);
+		fprintf(stream, " %s", name->text);
 	}
 	if (t->n == 0) {
 		fprintf(stream, "[]");
@@ -137,47 +461,47 @@ void showNamedType(Type *t, const char *name, FILE *stream) {
 void showSymbol(Symbol *s, FILE *stream) {
 	switch (s->kind) {
 			case SK_VAR:
-				showNamedType(&s->type, s->name, stream);
+				showNamedType(s->type, s->name, stream);
 				if (s->owner) {
-					fprintf(stream, ";\t// size=%d, idx=%d\n", typeSize(&s->type), s->varIdx);
+					fprintf(stream, ";\t// size=%d, idx=%d\n", typeSize(s->type), s->varIdx);
 				} else {
-					fprintf(stream, ";\t// size=%d, mem=%p\n", typeSize(&s->type), s->varMem);
+					fprintf(stream, ";\t// size=%d, offset=%d\n", typeSize(s->type), s->varIdx);
 				}
 				break;
 			case SK_PARAM: 
 				{
-					showNamedType(&s->type,s->name, stream);
-					fprintf(stream, " /*size=%d, idx=%d*/", typeSize(&s->type), s->paramIdx);
+					showNamedType(s->type,s->name, stream);
+					fprintf(stream, " /*size=%d, idx=%d*/", typeSize(s->type), s->paramIdx);
 				}
 				break;
 			case SK_FN: 
 				{
-					showNamedType(&s->type, s->name, stream);
+					showNamedType(s->type, s->name, stream);
 					fprintf(stream, "(");
 					bool next = false;
-					for(Symbol *param = s->fn.params; param; param = param->next) {
+					for (int i = 0; i < s->fn.nParams; ++i) {
 						if (next) {
 							fprintf(stream, ", ");
 						}
-						showSymbol(param, stream);
+						showSymbol(s->fn.params[i], stream);
 						next = true;
 					}
 					fprintf(stream, "){\n");
-					for(Symbol *local = s->fn.locals; local; local = local->next) {
+					for (int i = 0; i < s->fn.nLocals; ++i) {
 						fprintf(stream, "\t");
-						showSymbol(local, stream);
+						showSymbol(s->fn.locals[i], stream);
 					}
 					fprintf(stream, "\t}\n");
 				}
 				break;
 			case SK_STRUCT:
 				{
-					fprintf(stream, "struct %s{\n", s->name);
-					for (Symbol *m = s->structMembers; m; m = m->next) {
+					fprintf(stream, "struct %s{\n", s->name->text);
+					for (int i = 0; i < s->nMembers; ++i) {
 						fprintf(stream, "\t");
-						showSymbol(m, stream);
+						showSymbol(s->structMembers[i], stream);
 					}
-					fprintf(stream, "\t};\t// size=%d\n", typeSize(&s->type));
+					fprintf(stream, "\t};\t// size=%d\n", typeSize(s->type));
 				}
 				break;
 	}
@@ -191,41 +515,70 @@ void showDomain(Domain *d, const char *name, FILE *stream) {
 	fputs("\n", stream);
 }
 
-Symbol *findSymbolInDomain(Domain *d, const char *name) {
-	for(Symbol *s = d->symbols; s; s = s->next) {
-		if (!strcmp(s->name, name)) {
-			return s;
+Symbol *findSymbolInDomain(Domain *d, const Atom *name) {
+	if (!d->parent) {
+		return indexFind(d->index, d->nSlots, name);
+	}
+	// the symbols of the domains above d are newer, so they are before its symbol in the shadow chain
+	int e = scopeSlot(name)->entry;
+	for (; e >= d->firstEntry; e = entries[e].shadowed) {
+		if (entries[e].d == d) {
+			return entries[e].s;
 		}
 	}
 	return NULL;
 }
 
-Symbol *findSymbol(const char *name) {
-	for(Domain *d = symTable; d; d = d->parent) {
-		Symbol *s = findSymbolInDomain(d, name);
-		if (s) {
-			return s;
+Symbol *findSymbol(const Atom *name) {
+	if (symTable->parent) {
+		// the newest symbol with the name is from the innermost domain which has it
+		int e = scopeSlot(name)->entry;
+		if (e >= 0) {
+			return entries[e].s;
 		}
 	}
-	return NULL;
+	return indexFind(symTable->global->index, symTable->global->nSlots, name);
 }
 
 Symbol *addSymbolToDomain(Domain *d, Symbol *s) {
-	return addSymbolToList(&d->symbols, s);
+	s->next = NULL;
+	if (d->lastSymbol) {
+		d->lastSymbol->next = s;
+	} else {
+		d->symbols = s;
+	}
+	d->lastSymbol = s;
+	if (!d->parent) {
+		indexAdd(&d->index, &d->nSlots, d->nSymbols++, s);
+		return s;
+	}
+	if (nEntries == capEntries) {
+		capEntries = capEntries ? capEntries * 2 : 64;
+		entries = safeRealloc(entries, capEntries * sizeof(ScopeEntry));
+	}
+	ScopeSlot *slot = scopeSlot(s->name);
+	entries[nEntries] = (ScopeEntry) { s, d, slot->entry };
+	slot->entry = nEntries++;
+	return s;
+}
+
+Symbol *addGlobalVar(Domain *d, Symbol *v) {
+	int align = typeAlign(v->type);
+	v->varIdx = (d->dataSize + align - 1) / align * align;
+	d->dataSize = v->varIdx + typeSize(v->type);
+	return v;
 }
 
-Symbol *addExtFn(const char *name, void (*extFnPtr)(), Type ret) {
-	Symbol *fn = newSymbol(name, SK_FN);
+Symbol *addExtFn(const char *name, void (*extFnPtr)(), TypeId ret) {
+	Symbol *fn = newSymbol(atomGet(name), SK_FN);
 	fn->fn.extFnPtr = extFnPtr;
 	fn->type = ret;
 	addSymbolToDomain(symTable, fn);
 	return fn;
 }
 
-Symbol *addFnParam(Symbol *fn, const char *name, Type type) {
-	Symbol *param = newSymbol(name, SK_PARAM);
+Symbol *addFnParam(Symbol *fn, const char *name, TypeId type) {
+	Symbol *param = newMember(fn, atomGet(name), SK_PARAM);
 	param->type = type;
-	param->paramIdx = symbolsLen(fn->fn.params);
-	addSymbolToList(&fn->fn.params, dupSymbol(param));
-	return param;
+	return addParam(fn, param);
 }
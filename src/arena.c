@@ -0,0 +1,96 @@
+#include "arena.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_FIRST_BLOCK_SIZE 512
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+struct ArenaBlock
+{
+	struct ArenaBlock *next;	// the previously allocated block
+	char *end;					// the end of its memory
+	max_align_t data[];			// the memory handed out by the arena
+};
+
+void arenaInit(Arena *a) {
+	a->blocks = NULL;
+	a->pos = NULL;
+	a->end = NULL;
+}
+
+void *arenaAlloc(Arena *a, size_t nBytes) {
+	nBytes = (nBytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if ((size_t) (a->end - a->pos) < nBytes) {
+		// each block is twice the previous one, up to ARENA_BLOCK_SIZE; requests bigger than that get a block of their own
+		size_t size = ARENA_FIRST_BLOCK_SIZE;
+		if (a->blocks) {
+			size = (size_t) (a->blocks->end - (char*) a->blocks->data) * 2;
+			size = size < ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		}
+		size = nBytes > size ? nBytes : size;
+		struct ArenaBlock *b = (struct ArenaBlock*) safeAlloc(sizeof(struct ArenaBlock) + size);
+		b->next = a->blocks;
+		a->blocks = b;
+		a->pos = (char*) b->data;
+		a->end = b->end = a->pos + size;
+	}
+	void *p = a->pos;
+	a->pos += nBytes;
+	return p;
+}
+
+char *arenaStrndup(Arena *a, const char *str, size_t n) {
+	char *s = (char*) arenaAlloc(a, n + 1);
+	memcpy(s, str, n);
+	s[n] = '\0';
+	return s;
+}
+
+void arenaMerge(Arena *dst, Arena *src) {
+	if (!src->blocks) {
+		return;
+	}
+	if (!dst->blocks) {
+		*dst = *src;
+	} else {
+		// the blocks of src go after the current block of dst, which keeps handing out memory
+		struct ArenaBlock *last = src->blocks;
+		while (last->next) {
+			last = last->next;
+		}
+		last->next = dst->blocks->next;
+		dst->blocks->next = src->blocks;
+	}
+	arenaInit(src);
+}
+
+ArenaMark arenaMark(Arena *a) {
+	return (ArenaMark) { a->blocks, a->pos };
+}
+
+void arenaRelease(Arena *a, ArenaMark m) {
+	while (a->blocks != m.block) {
+		struct ArenaBlock *b = a->blocks;
+		if (!m.block && !b->next) {
+			// the mark is from before the first block, which is kept empty
+			a->pos = (char*) b->data;
+			a->end = b->end;
+			return;
+		}
+		a->blocks = b->next;
+		free(b);
+	}
+	a->pos = m.pos;
+	a->end = m.block ? m.block->end : NULL;
+}
+
+void arenaFree(Arena *a) {
+	for (struct ArenaBlock *b = a->blocks, *next; b; b = next) {
+		next = b->next;
+		free(b);
+	}
+	arenaInit(a);
+}
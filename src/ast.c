@@ -0,0 +1,85 @@
+#include "ast.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *kindNames[] = {
+	"int", "double", "char", "string", "var", "call", "index", "field", "neg", "not", "cast", "binary", "assign",
+	"block", "if", "while", "return", "expr", "fn"
+};
+
+// shows the node id and the nodes linked after it
+static void showList(Ast *ast, NodeId id, int depth, FILE *stream);
+
+void astInit(Ast *ast) {
+	ast->nodes = NULL;
+	ast->n = 1;
+	ast->cap = 0;
+	arenaInit(&ast->text);
+	ast->fns = NO_NODE;
+	ast->lastFn = NO_NODE;
+}
+
+NodeId astAdd(Ast *ast, NodeKind kind, int line) {
+	if (ast->n >= ast->cap) {
+		ast->cap = ast->cap ? ast->cap * 2 : 1024;
+		ast->nodes = safeRealloc(ast->nodes, ast->cap * sizeof(Node));
+	}
+	NodeId id = ast->n++;
+	Node *node = &ast->nodes[id];
+	memset(node, 0, sizeof(Node));
+	node->kind = kind;
+	node->line = line;
+	return id;
+}
+
+void astClear(Ast *ast) {
+	ast->n = 1;
+	arenaFree(&ast->text);
+	ast->fns = NO_NODE;
+	ast->lastFn = NO_NODE;
+}
+
+void astFree(Ast *ast) {
+	free(ast->nodes);
+	arenaFree(&ast->text);
+	astInit(ast);
+}
+
+void showAst(Ast *ast, FILE *stream) {
+	showList(ast, ast->fns, 0, stream);
+}
+
+void showList(Ast *ast, NodeId id, int depth, FILE *stream) {
+	for (; id != NO_NODE; id = ast->nodes[id].next) {
+		Node *node = &ast->nodes[id];
+		fprintf(stream, "%d\t", node->line);
+		for (int i = 0; i < depth; ++i) {
+			fputc('\t', stream);
+		}
+		fputs(kindNames[node->kind], stream);
+		switch (node->kind) {
+			case N_INT: fprintf(stream, " %d", node->i); break;
+			case N_DOUBLE: fprintf(stream, " %g", node->d); break;
+			case N_CHAR: fprintf(stream, " '%c'", node->ch); break;
+			case N_STRING: fprintf(stream, " \"%s\"", node->str.chars); break;
+			case N_VAR:
+			case N_CALL:
+			case N_FIELD:
+			case N_FN:
+				fprintf(stream, " %s", node->sym->name->text);
+				break;
+			case N_BINARY: fprintf(stream, " %s", getTokenName(node->op)); break;
+			default: break;
+		}
+		if (node->kind < N_BLOCK) {
+			fputs(" : ", stream);
+			showNamedType(node->type, NULL, stream);
+		}
+		fputc('\n', stream);
+		showList(ast, node->a, depth + 1, stream);
+		showList(ast, node->b, depth + 1, stream);
+		showList(ast, node->c, depth + 1, stream);
+	}
+}
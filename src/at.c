@@ -1,102 +1,40 @@
-#include <string.h>
 #include "at.h"
 
+/*
+	The results of convTo and arithTypeTo for each pair of type classes, computed once for all the types.
+	A struct is converted only to itself, which has the same id, so its class has no conversions.
+*/
+static const bool convTable[TC_COUNT][TC_COUNT] = {
+	//				int		double	char	void	array	struct
+	[TC_INT] =		{ true,	true,	true,	false,	false,	false },
+	[TC_DOUBLE] =	{ true,	true,	true,	false,	false,	false },
+	[TC_CHAR] =		{ true,	true,	true,	false,	false,	false },
+	// the pointers (arrays) can only be converted one to the other
+	[TC_ARRAY] =	{ false,	false,	false,	false,	true,	false },
+};
+
+// there are no arithmetic operations with pointers, structs or void
+static const TypeId arithTable[TC_COUNT][TC_COUNT] = {
+	//				int			double		char		void		array		struct
+	[TC_INT] =		{ TY_INT,		TY_DOUBLE,	TY_INT,		TY_NONE,	TY_NONE,	TY_NONE },
+	[TC_DOUBLE] =	{ TY_DOUBLE,	TY_DOUBLE,	TY_DOUBLE,	TY_NONE,	TY_NONE,	TY_NONE },
+	[TC_CHAR] =		{ TY_INT,		TY_DOUBLE,	TY_CHAR,	TY_NONE,	TY_NONE,	TY_NONE },
+	[TC_VOID] =		{ TY_NONE,		TY_NONE,	TY_NONE,	TY_NONE,	TY_NONE,	TY_NONE },
+	[TC_ARRAY] =	{ TY_NONE,		TY_NONE,	TY_NONE,	TY_NONE,	TY_NONE,	TY_NONE },
+	[TC_STRUCT] =	{ TY_NONE,		TY_NONE,	TY_NONE,	TY_NONE,	TY_NONE,	TY_NONE },
+};
+
 bool canBeScalar(Ret* r) {
-	Type* t = &r->type;
-	if (t->n >= 0) {
-		return false;
-	}
-	if (t->tb == TB_VOID) {
-		return false;
-	}
-	return true;
+	TypeClass cls = typeOf(r->type)->cls;
+	return cls != TC_ARRAY && cls != TC_VOID;
 }
 
-bool convTo(Type *src, Type *dst) {
-	// the pointers (arrays) can only be converted one to the other
-	if (src->n >= 0) {
-		if (dst->n >= 0) {
-			return true;
-		}
-		return false;
-	}
-	if (dst->n >= 0) {
-		return false;
-	}
-	switch (src->tb) {
-		case TB_INT:
-		case TB_DOUBLE:
-		case TB_CHAR:
-			switch (dst->tb) {
-				case TB_INT:
-				case TB_CHAR:
-				case TB_DOUBLE:
-					return true;
-				default:
-					return false;
-			}
-		// a struct can only be converted to itself
-		case TB_STRUCT:
-			if (dst->tb == TB_STRUCT && src->s == dst->s) {
-				return true;
-			}
-			return false;
-		default:
-			return false;
-	}
+bool convTo(TypeId src, TypeId dst) {
+	const Type *a = typeOf(src);
+	return convTable[a->cls][typeOf(dst)->cls] || (src == dst && a->cls == TC_STRUCT);
 }
 
-bool arithTypeTo(Type *t1, Type *t2, Type *dst) {
-	// there are no arithmetic operations with pointers
-	if (t1->n >= 0 || t2->n >= 0) {
-		return false;
-	}
-	// the result of an arithmetic operation cannot be a poinetr or struct
-	dst->s = NULL;
-	dst->n = -1;
-	switch (t1->tb) {
-		case TB_INT:
-			switch (t2->tb) {
-				case TB_INT:
-				case TB_CHAR:
-					dst->tb = TB_INT;
-					return true;
-				case TB_DOUBLE:
-					dst->tb = TB_DOUBLE;
-					return true;
-				default:
-					return false;
-			}
-		case TB_DOUBLE:
-			switch (t2->tb) {
-				case TB_INT:
-				case TB_DOUBLE:
-				case TB_CHAR:
-					dst->tb = TB_DOUBLE;
-					return true;
-				default:
-					return false;
-			}
-		case TB_CHAR:
-			switch (t2->tb) {
-				case TB_INT:
-				case TB_DOUBLE:
-				case TB_CHAR:
-					dst->tb = t2->tb;
-					return true;
-				default:
-					return false;
-			}
-		default:
-			return false;
-	}
+bool arithTypeTo(TypeId t1, TypeId t2, TypeId *dst) {
+	*dst = arithTable[typeOf(t1)->cls][typeOf(t2)->cls];
+	return *dst != TY_NONE;
 }
-
-Symbol *findSymbolInList(Symbol *list, const char *name) {
-	for (Symbol *s = list; s; s = s->next) {
-		if (!strcmp(s->name, name)) {
-			return s;
-		}
-	}
-	return NULL;
-}
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "atom.h"
+#include "arena.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define INITIAL_BUCKETS 1024
+#define CACHE_SIZE 256	// the number of entries in the cache of each thread, a power of 2
+
+static Atom **buckets = NULL;	// the hash table, each bucket is a list of atoms
+static unsigned numBuckets = 0;	// always a power of 2
+static unsigned numAtoms = 0;
+static Arena atomsArena;		// the memory of all atoms and their chars
+static pthread_mutex_t atomsLock = PTHREAD_MUTEX_INITIALIZER;	// guards the table, so the lexer threads can intern names
+
+/*
+	Each thread keeps the atoms it found recently, indexed by hash, so most of the names
+	are found without taking the lock. The atoms are never changed after they are added to the table,
+	so they can be read from any thread.
+	The cache is valid only for the generation of the table it was filled from (freeAtoms starts a new one).
+*/
+static unsigned generation = 1;
+static _Thread_local const Atom *cache[CACHE_SIZE];
+static _Thread_local unsigned cacheGeneration;
+
+// FNV-1a
+static unsigned hashChars(const char *text, int len) {
+	unsigned h = 2166136261u;
+	for (int i = 0; i < len; ++i) {
+		h = (h ^ (unsigned char) text[i]) * 16777619u;
+	}
+	return h;
+}
+
+// doubles the number of buckets and redistributes the atoms
+static void growBuckets() {
+	unsigned n = numBuckets * 2;
+	Atom **b = (Atom**) safeAlloc(n * sizeof(Atom*));
+	memset(b, 0, n * sizeof(Atom*));
+	for (unsigned i = 0; i < numBuckets; ++i) {
+		for (Atom *a = buckets[i], *next; a; a = next) {
+			next = a->next;
+			a->next = b[a->hash & (n - 1)];
+			b[a->hash & (n - 1)] = a;
+		}
+	}
+	free(buckets);
+	buckets = b;
+	numBuckets = n;
+}
+
+static const Atom *findOrAdd(const char *text, int len, unsigned h);
+
+const Atom *atomIntern(const char *text, int len) {
+	unsigned h = hashChars(text, len);
+	if (cacheGeneration != generation) {
+		memset(cache, 0, sizeof(cache));
+		cacheGeneration = generation;
+	}
+	const Atom **cached = &cache[h & (CACHE_SIZE - 1)];
+	if (*cached && (*cached)->hash == h && (*cached)->len == len && !memcmp((*cached)->text, text, len)) {
+		return *cached;
+	}
+	pthread_mutex_lock(&atomsLock);
+	*cached = findOrAdd(text, len, h);
+	pthread_mutex_unlock(&atomsLock);
+	return *cached;
+}
+
+// returns the atom from the table, adding it if it is new; the caller holds atomsLock
+static const Atom *findOrAdd(const char *text, int len, unsigned h) {
+	if (!buckets) {
+		numBuckets = INITIAL_BUCKETS;
+		buckets = (Atom**) safeAlloc(numBuckets * sizeof(Atom*));
+		memset(buckets, 0, numBuckets * sizeof(Atom*));
+		arenaInit(&atomsArena);
+	}
+	for (Atom *a = buckets[h & (numBuckets - 1)]; a; a = a->next) {
+		if (a->hash == h && a->len == len && !memcmp(a->text, text, len)) {
+			return a;
+		}
+	}
+	if (numAtoms >= numBuckets) {
+		growBuckets();
+	}
+	Atom *a = (Atom*) arenaAlloc(&atomsArena, sizeof(Atom));
+	a->text = arenaStrndup(&atomsArena, text, len);
+	a->len = len;
+	a->hash = h;
+	a->next = buckets[h & (numBuckets - 1)];
+	buckets[h & (numBuckets - 1)] = a;
+	++numAtoms;
+	return a;
+}
+
+const Atom *atomGet(const char *text) {
+	return atomIntern(text, strlen(text));
+}
+
+void freeAtoms() {
+	pthread_mutex_lock(&atomsLock);
+	free(buckets);
+	buckets = NULL;
+	numBuckets = 0;
+	numAtoms = 0;
+	arenaFree(&atomsArena);
+	++generation;
+	pthread_mutex_unlock(&atomsLock);
+}
@@ -0,0 +1,580 @@
+#include "compiler.h"
+#include "gc.h"
+#include "module.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// the items done by a phase of the compilation, shared by its threads
+typedef struct _Phase
+{
+	Compiler *c;
+	void (*work)(struct _Phase *phase, int worker, int item);
+	int nItems;
+	const int *order;		// the units of the scan, from the longest one
+	FnBody *bodies;			// the functions of the build, from the longest body
+	atomic_int next;		// the next item to be taken by a thread
+	pthread_mutex_t lock;	// the errors of a unit can be added by many threads
+} Phase;
+
+// the arguments of a thread of a phase
+typedef struct
+{
+	Phase *phase;
+	int worker;				// the index of the thread, from 0
+} Worker;
+
+// adds to the list an error with a copy of msg
+static void addError(CompileError **errors, int *n, int *cap, const char *file, int line, const char *msg);
+// adds an error to the unit while other threads can also add errors to it
+static void unitError(Phase *phase, Unit *u, int line, const char *msg);
+static void clearErrors(Compiler *c);
+// moves the errors of the units to the compiler, in the order of the units and of their lines, and returns their number
+static int collectErrors(Compiler *c);
+static void collectUnit(Compiler *c, Unit *u);
+// keeps an error which was found before anything was changed
+static bool fail(Compiler *c, const char *msg);
+
+/*
+	runs the work for all the items of the phase on nThreads threads, the calling one included
+	returns the number of threads which were used
+*/
+static int runPhase(Phase *phase, int nThreads);
+static void *phaseThread(void *arg);
+
+// scans the text of the unit order[item]
+static void scanUnit(Phase *phase, int worker, int item);
+// adds the declaration which starts at the token idx to the global domain and returns the index of the token after it
+static int linkDeclaration(Compiler *c, Unit *u, int idx);
+// parses the body of the function bodies[item] and generates its code, in the tree of the worker
+static void buildFn(Phase *phase, int worker, int item);
+// sorts the functions from the one with the most tokens
+static int largerBody(const void *a, const void *b);
+// builds the body of a function of the lazy mode, with its calls evaluated; returns false if it has errors
+static bool buildLazy(FnBody *b);
+// Vm.genLazy: builds the body of the function on its first call
+static void genLazy(void *fn);
+static void freeUnit(Unit *u);
+static void freeModule(Module *m);
+
+Compiler *newCompiler(FILE *out) {
+	Compiler *c = (Compiler*) safeAlloc(sizeof(Compiler));
+	memset(c, 0, sizeof(Compiler));
+	Domain *saved = symTable;
+	symTable = NULL;
+	c->global = pushDomain();
+	vmInit();
+	symTable = saved;
+	c->vm = newVm(out);
+	c->vm->genLazy = genLazy;
+	return c;
+}
+
+bool compile(Compiler *c, const char *text) {
+	const char *names[] = { NULL };
+	return compileFiles(c, 1, names, &text, 0);
+}
+
+bool compileFiles(Compiler *c, int nFiles, const char **names, const char **texts, int nThreads) {
+	clearErrors(c);
+	if (c->units) {
+		return fail(c, "The compiler already has a program");
+	}
+	c->units = (Unit*) safeAlloc(nFiles * sizeof(Unit));
+	memset(c->units, 0, nFiles * sizeof(Unit));
+	c->nUnits = nFiles;
+	for (int i = 0; i < nFiles; ++i) {
+		c->units[i].name = names[i];
+		c->units[i].text = texts[i];
+	}
+	if (nThreads <= 0) {
+		nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	// the longest files are started first, so the threads do not wait at the end for a long file
+	int *order = (int*) safeAlloc(nFiles * sizeof(int));
+	size_t *lens = (size_t*) safeAlloc(nFiles * sizeof(size_t));
+	for (int i = 0; i < nFiles; ++i) {
+		size_t len = strlen(texts[i]);
+		int k = i;
+		for (; k > 0 && lens[k - 1] < len; --k) {
+			lens[k] = lens[k - 1];
+			order[k] = order[k - 1];
+		}
+		lens[k] = len;
+		order[k] = i;
+	}
+	free(lens);
+
+	bool ok = false;
+	Phase scan = { .c = c, .work = scanUnit, .nItems = nFiles, .order = order };
+	runPhase(&scan, nThreads);
+	free(order);
+	if (!collectErrors(c)) {
+		// the link is done in the order of the files, by this thread
+		Domain *saved = symTable;
+		symTable = c->global;
+		Symbol *last = c->global->lastSymbol;
+		int nTasks = 0;
+		for (int i = 0; i < nFiles; ++i) {
+			Unit *u = &c->units[i];
+			for (int idx = 0; tkCode(u->tokens, idx) != END; ) {
+				idx = linkDeclaration(c, u, idx);
+			}
+			nTasks += u->nFns;
+		}
+		parseEnd();
+		symTable = saved;
+		c->linked = last ? last->next : c->global->symbols;
+		if (!collectErrors(c)) {
+			c->bodies = (FnBody*) safeAlloc((nTasks ? nTasks : 1) * sizeof(FnBody));
+			c->nBodies = nTasks;
+			int n = 0;
+			for (int i = 0; i < nFiles; ++i) {
+				Unit *u = &c->units[i];
+				for (int k = 0; k < u->nFns; ++k) {
+					Declaration *d = &u->fns[k];
+					// the text is kept for writeModule
+					int start = tkOffset(u->tokens, d->bodyTk);
+					int len = tkOffset(u->tokens, d->endTk - 1) + 1 - start;
+					c->bodies[n++] = (FnBody) { c, u, d, false, u->text + start, len, tkLine(u->tokens, d->bodyTk) };
+				}
+			}
+			if (c->lazy) {
+				// a single tree, for the bodies built by the thread which runs the program
+				c->nTrees = 1;
+			} else {
+				// the bodies are taken one by one by the threads, so a file with many functions is built by all of them
+				qsort(c->bodies, nTasks, sizeof(FnBody), largerBody);
+				c->nTrees = nThreads < nTasks ? nThreads : (nTasks ? nTasks : 1);
+			}
+			c->trees = (Ast*) safeAlloc(c->nTrees * sizeof(Ast));
+			for (int i = 0; i < c->nTrees; ++i) {
+				astInit(&c->trees[i]);
+			}
+			if (c->lazy) {
+				for (int k = 0; k < nTasks; ++k) {
+					genLazyEntry(c->bodies[k].d->fn, &c->bodies[k]);
+				}
+				ok = true;
+			} else {
+				Phase build = { .c = c, .work = buildFn, .nItems = nTasks, .bodies = c->bodies };
+				pthread_mutex_init(&build.lock, NULL);
+				runPhase(&build, c->nTrees);
+				pthread_mutex_destroy(&build.lock);
+				ok = !collectErrors(c);
+				if (ok) {
+					// the calls run the code of other functions, so they are evaluated after all the code is generated
+					for (int k = 0; k < nTasks; ++k) {
+						foldCalls(c->bodies[k].d->fn);
+					}
+				}
+			}
+		}
+	}
+	// the lazy mode parses the bodies later
+	if (!ok || !c->lazy) {
+		for (int i = 0; i < nFiles; ++i) {
+			if (c->units[i].tokens) {
+				freeTokens(c->units[i].tokens);
+				c->units[i].tokens = NULL;
+			}
+		}
+	}
+	c->compiled = ok;
+	return ok;
+}
+
+bool importModule(Compiler *c, const char *path) {
+	clearErrors(c);
+	if (c->units) {
+		return fail(c, "The modules must be imported before the program is compiled");
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return fail(c, "The module cannot be opened");
+	}
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (!fstat(fd, &st) && st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		return fail(c, "The module cannot be read");
+	}
+	Module *m = (Module*) safeAlloc(sizeof(Module));
+	memset(m, 0, sizeof(Module));
+	m->map = map;
+	m->size = st.st_size;
+	m->unit.name = path;
+
+	Domain *saved = symTable;
+	symTable = c->global;
+	Symbol *last = c->global->lastSymbol;
+	ModuleFn *fns = NULL;
+	ErrTrap trap;
+	ErrTrap *savedTrap = errTrap;
+	errTrap = &trap;
+	if (setjmp(trap.env)) {
+		errTrap = savedTrap;
+		symTable = saved;
+		// the symbols added before the error are removed, so the compiler can go on without the module
+		Symbol *s = cutDomain(c->global, last);
+		while (s) {
+			Symbol *next = s->next;
+			freeSymbol(c->global, s);
+			s = next;
+		}
+		addError(&c->errors, &c->nErrors, &c->capErrors, m->unit.name, 0, trap.msg);
+		freeModule(m);
+		return false;
+	}
+	int n = readInterface(map, m->size, c->global, &fns);
+	errTrap = savedTrap;
+	symTable = saved;
+
+	m->unit.fns = (Declaration*) safeAlloc((n ? n : 1) * sizeof(Declaration));
+	m->unit.nFns = m->unit.capFns = n;
+	m->bodies = (FnBody*) safeAlloc((n ? n : 1) * sizeof(FnBody));
+	m->nBodies = n;
+	for (int k = 0; k < n; ++k) {
+		// the lines of the body are counted from its text, which starts at the line 1
+		m->unit.fns[k] = (Declaration) { fns[k].fn, 1, 0, 0 };
+		m->bodies[k] = (FnBody) { c, &m->unit, &m->unit.fns[k], false, fns[k].body, fns[k].len, fns[k].line };
+		genLazyEntry(fns[k].fn, &m->bodies[k]);
+	}
+	free(fns);
+	if (c->nModules % 8 == 0) {
+		c->modules = safeRealloc(c->modules, (c->nModules + 8) * sizeof(Module*));
+	}
+	c->modules[c->nModules++] = m;
+	return true;
+}
+
+bool writeModule(Compiler *c, const char *path) {
+	clearErrors(c);
+	if (!c->compiled) {
+		return fail(c, "The program is not compiled");
+	}
+	FILE *out = fopen(path, "wb");
+	if (!out) {
+		return fail(c, "The module cannot be created");
+	}
+	ModuleFn *fns = (ModuleFn*) safeAlloc((c->nBodies ? c->nBodies : 1) * sizeof(ModuleFn));
+	for (int k = 0; k < c->nBodies; ++k) {
+		FnBody *b = &c->bodies[k];
+		fns[k] = (ModuleFn) { b->d->fn, b->text, b->len, b->line };
+	}
+	bool ok = c->linked ? writeInterface(out, c->global->symbols, c->linked, fns, c->nBodies) : true;
+	ok = !fclose(out) && ok;
+	free(fns);
+	return ok || fail(c, "The module cannot be written");
+}
+
+bool compileFn(Compiler *c, const char *name) {
+	clearErrors(c);
+	if (!c->compiled) {
+		return fail(c, "The program is not compiled");
+	}
+	Symbol *f = findSymbolInDomain(c->global, atomGet(name));
+	if (!f || f->kind != SK_FN || f->fn.extFnPtr) {
+		return fail(c, "The program has no such function");
+	}
+	if (f->fn.instr->op != OP_LAZY) {
+		return true;
+	}
+	buildLazy((FnBody*) f->fn.instr->arg.p);
+	return !collectErrors(c);
+}
+
+bool runMain(Compiler *c) {
+	clearErrors(c);
+	if (!c->compiled) {
+		return fail(c, "The program is not compiled");
+	}
+	Symbol *mainFn = findSymbolInDomain(c->global, atomGet("main"));
+	if (!mainFn || mainFn->kind != SK_FN) {
+		return fail(c, "The program has no main function");
+	}
+	ErrTrap trap;
+	ErrTrap *savedTrap = errTrap;
+	Instr *volatile program = NULL;		// it is changed after setjmp and freed after an error
+	errTrap = &trap;
+	if (setjmp(trap.env)) {
+		freeInstrs(program);
+		errTrap = savedTrap;
+		// an error from a body built by the run is already kept by its file
+		if (!collectErrors(c)) {
+			addError(&c->errors, &c->nErrors, &c->capErrors, NULL, trap.line, trap.msg);
+		}
+		return false;
+	}
+	if (!c->vm->globals) {
+		// the globals keep their values from one run to the next
+		vmGlobals(c->vm, c->global->dataSize);
+	}
+	program = genProgram(mainFn);
+	c->vm->SP = c->vm->stack - 1;
+	run(c->vm, program);
+	freeInstrs(program);
+	errTrap = savedTrap;
+	return true;
+}
+
+void freeCompiler(Compiler *c) {
+	for (int i = 0; i < c->nUnits; ++i) {
+		freeUnit(&c->units[i]);
+	}
+	free(c->units);
+	free(c->bodies);
+	for (int i = 0; i < c->nTrees; ++i) {
+		astFree(&c->trees[i]);
+	}
+	free(c->trees);
+	clearErrors(c);
+	free(c->errors);
+	Domain *saved = symTable;
+	symTable = c->global;
+	dropDomain();
+	symTable = saved;
+	for (int i = 0; i < c->nModules; ++i) {
+		freeModule(c->modules[i]);
+	}
+	free(c->modules);
+	freeVm(c->vm);
+	free(c);
+}
+
+void addError(CompileError **errors, int *n, int *cap, const char *file, int line, const char *msg) {
+	if (*n == *cap) {
+		*cap = *cap ? *cap * 2 : 8;
+		*errors = safeRealloc(*errors, *cap * sizeof(CompileError));
+	}
+	CompileError *e = &(*errors)[(*n)++];
+	e->file = file;
+	e->line = line;
+	e->msg = strcpy(safeAlloc(strlen(msg) + 1), msg);
+}
+
+void unitError(Phase *phase, Unit *u, int line, const char *msg) {
+	pthread_mutex_lock(&phase->lock);
+	addError(&u->errors, &u->nErrors, &u->capErrors, u->name, line, msg);
+	pthread_mutex_unlock(&phase->lock);
+}
+
+void clearErrors(Compiler *c) {
+	for (int k = 0; k < c->nErrors; ++k) {
+		free(c->errors[k].msg);
+	}
+	c->nErrors = 0;
+}
+
+int collectErrors(Compiler *c) {
+	for (int i = 0; i < c->nModules; ++i) {
+		collectUnit(c, &c->modules[i]->unit);
+	}
+	for (int i = 0; i < c->nUnits; ++i) {
+		collectUnit(c, &c->units[i]);
+	}
+	return c->nErrors;
+}
+
+void collectUnit(Compiler *c, Unit *u) {
+	// the functions of a unit can end in any order, but each one has at most an error
+	for (int k = 1; k < u->nErrors; ++k) {
+		CompileError e = u->errors[k];
+		int j = k;
+		for (; j > 0 && u->errors[j - 1].line > e.line; --j) {
+			u->errors[j] = u->errors[j - 1];
+		}
+		u->errors[j] = e;
+	}
+	for (int k = 0; k < u->nErrors; ++k) {
+		addError(&c->errors, &c->nErrors, &c->capErrors, u->errors[k].file, u->errors[k].line, u->errors[k].msg);
+		free(u->errors[k].msg);
+	}
+	u->nErrors = 0;
+}
+
+bool fail(Compiler *c, const char *msg) {
+	addError(&c->errors, &c->nErrors, &c->capErrors, NULL, 0, msg);
+	return false;
+}
+
+int runPhase(Phase *phase, int nThreads) {
+	if (nThreads > phase->nItems) {
+		nThreads = phase->nItems;
+	}
+	pthread_t *threads = (pthread_t*) safeAlloc((nThreads ? nThreads : 1) * sizeof(pthread_t));
+	Worker *workers = (Worker*) safeAlloc((nThreads ? nThreads : 1) * sizeof(Worker));
+	workers[0] = (Worker) { phase, 0 };
+	int n = 1;
+	// if a thread cannot be created, its items are taken by the other ones
+	for (; n < nThreads; ++n) {
+		workers[n] = (Worker) { phase, n };
+		if (pthread_create(&threads[n], NULL, phaseThread, &workers[n])) {
+			break;
+		}
+	}
+	phaseThread(&workers[0]);
+	for (int i = 1; i < n; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	free(workers);
+	free(threads);
+	return n;
+}
+
+void *phaseThread(void *arg) {
+	Worker *w = (Worker*) arg;
+	for (;;) {
+		int k = atomic_fetch_add(&w->phase->next, 1);
+		if (k >= w->phase->nItems) {
+			// the parser keeps its marks between the items of a thread
+			parseEnd();
+			return NULL;
+		}
+		w->phase->work(w->phase, w->worker, k);
+	}
+}
+
+void scanUnit(Phase *phase, int worker, int item) {
+	Unit *u = &phase->c->units[phase->order[item]];
+	ErrTrap trap;
+	ErrTrap *saved = errTrap;
+	errTrap = &trap;
+	if (setjmp(trap.env)) {
+		addError(&u->errors, &u->nErrors, &u->capErrors, u->name, trap.line, trap.msg);
+	} else {
+		u->tokens = tokenize(u->text);
+		// the lines are computed on the first use, so they are computed now, before the tokens are shared by the threads
+		tkLine(u->tokens, 0);
+	}
+	errTrap = saved;
+}
+
+int linkDeclaration(Compiler *c, Unit *u, int idx) {
+	ErrTrap trap;
+	ErrTrap *saved = errTrap;
+	errTrap = &trap;
+	if (setjmp(trap.env)) {
+		// the domains opened by the declaration are closed and the next declarations are still linked
+		while (symTable != c->global) {
+			dropDomain();
+		}
+		errTrap = saved;
+		addError(&u->errors, &u->nErrors, &u->capErrors, u->name, trap.line, trap.msg);
+		return skipTopLevel(u->tokens, idx);
+	}
+	Declaration d;
+	int next = parseDeclaration(u->tokens, idx, &d);
+	if (d.fn) {
+		// the functions can call each other from any file, so their first instructions are needed by all the threads
+		genEntry(d.fn);
+		if (u->nFns == u->capFns) {
+			u->capFns = u->capFns ? u->capFns * 2 : 16;
+			u->fns = safeRealloc(u->fns, u->capFns * sizeof(Declaration));
+		}
+		u->fns[u->nFns++] = d;
+	}
+	errTrap = saved;
+	return next;
+}
+
+void buildFn(Phase *phase, int worker, int item) {
+	Compiler *c = phase->c;
+	FnBody *t = &phase->bodies[item];
+	// the global domain is only read by the threads
+	Domain *saved = symTable;
+	symTable = c->global;
+	ErrTrap trap;
+	ErrTrap *savedTrap = errTrap;
+	errTrap = &trap;
+	if (setjmp(trap.env)) {
+		while (symTable != c->global) {
+			dropDomain();
+		}
+		unitError(phase, t->u, trap.line, trap.msg);
+	} else {
+		Ast *tree = &c->trees[worker];
+		genFunction(tree, parseFnBody(t->u->tokens, t->d, tree));
+	}
+	errTrap = savedTrap;
+	symTable = saved;
+}
+
+int largerBody(const void *a, const void *b) {
+	const Declaration *da = ((const FnBody*) a)->d, *db = ((const FnBody*) b)->d;
+	return (db->endTk - db->bodyTk) - (da->endTk - da->bodyTk);
+}
+
+bool buildLazy(FnBody *b) {
+	if (b->failed) {
+		return false;
+	}
+	Compiler *c = b->c;
+	Domain *saved = symTable;
+	symTable = c->global;
+	// the body of a function from a module is scanned now, from its text
+	Tokens *volatile tokens = b->u->tokens;
+	ErrTrap trap;
+	ErrTrap *savedTrap = errTrap;
+	errTrap = &trap;
+	if (setjmp(trap.env)) {
+		while (symTable != c->global) {
+			dropDomain();
+		}
+		int line = trap.line;
+		if (!b->u->tokens && line) {
+			line += b->line - 1;
+		}
+		addError(&b->u->errors, &b->u->nErrors, &b->u->capErrors, b->u->name, line, trap.msg);
+		b->failed = true;
+	} else {
+		if (!tokens) {
+			tokens = tokenize(b->text);
+		}
+		genFunction(&c->trees[0], parseFnBody(tokens, b->d, &c->trees[0]));
+		foldCalls(b->d->fn);
+	}
+	errTrap = savedTrap;
+	symTable = saved;
+	parseEnd();
+	if (tokens && !b->u->tokens) {
+		freeTokens(tokens);
+	}
+	return !b->failed;
+}
+
+void genLazy(void *fn) {
+	FnBody *b = (FnBody*) fn;
+	if (!buildLazy(b)) {
+		err("The function %s has errors", b->d->fn->name->text);
+	}
+}
+
+void freeUnit(Unit *u) {
+	if (u->tokens) {
+		freeTokens(u->tokens);
+	}
+	free(u->fns);
+	for (int k = 0; k < u->nErrors; ++k) {
+		free(u->errors[k].msg);
+	}
+	free(u->errors);
+}
+
+void freeModule(Module *m) {
+	freeUnit(&m->unit);
+	free(m->bodies);
+	munmap(m->map, m->size);
+	free(m);
+}
@@ -0,0 +1,458 @@
+#include "doc.h"
+#include "parser.h"
+#include "utils.h"
+#include "vm.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_TEXT_GAP 64
+
+// the symbols changed by parsing again a part of a document
+typedef struct
+{
+	Symbol **removed;	// the old symbols of the items which are parsed again
+	bool *matched;		// true if the removed symbol was defined again with the same interface
+	int nRemoved;
+	int capRemoved;
+} Reparse;
+
+// returns an allocated copy of a '\0' terminated string
+static char *copyText(const char *s);
+
+// moves the gap of the text before the char pos
+static void moveTextGap(Doc *doc, int pos);
+
+// adds an edit of the current text to the pending changes
+static void addPending(Doc *doc, int start, int end, int len);
+
+// scans again the tokens and parses again the items changed by the pending changes
+static void update(Doc *doc);
+
+// scans again the pending changes; returns false on a lexical error
+static bool relex(Doc *doc, int *i0, int *nRemoved, int *nAdded);
+
+// returns the item k
+static DocItem *itemAt(Doc *doc, int k);
+
+// returns the index of the token tk of the item k, where the indexes after the gap are from the end of nTks tokens
+static int itemTk(Doc *doc, int k, int tk, int nTks);
+
+// returns the index of the first item which starts at or after the token idx, with the same nTks as itemTk
+static int firstItemAt(Doc *doc, int idx, int nTks);
+
+// returns the symbol of the last item before the item k which has one, or the last external function
+static Symbol *symbolBefore(Doc *doc, int k);
+
+/*
+	moves the gap of the items and of their errors before the item k, with the same nTks as itemTk
+	the symbols of the items which go after the gap are taken out of the global domain and the ones
+	which go before it are added back
+*/
+static void moveItemGap(Doc *doc, int k, int nTks);
+
+// doubles the capacity of an array with a gap, whose n elements of the given size from gap are at its end
+static void *growGapped(void *array, int n, int *cap, int gap, size_t size);
+
+/*
+	parses again the items from k0 to kc-1, which are the last ones before the gap, starting from the token pos,
+	and the items after the gap if needed
+*/
+static void reparse(Doc *doc, int k0, int kc, int pos);
+
+// adds the old symbol of an item which is parsed again
+static void addRemoved(Reparse *r, Symbol *s);
+
+// removes the first item after the gap, which is parsed again
+static void takeNext(Doc *doc, Reparse *r);
+
+// adds an item before the gap and parses it from the token pos
+static DocItem *parseItem(Doc *doc, int pos);
+
+// adds the error of the item added by parseItem
+static void addError(Doc *doc, int tk, char *msg);
+
+// returns true if the next items can use the new symbol b in the same way as the old symbol a
+static bool sameInterface(Symbol *a, Symbol *b);
+
+
+Doc *docOpen(const char *text, int len) {
+	Doc *doc = (Doc*) safeAlloc(sizeof(Doc));
+	memset(doc, 0, sizeof(Doc));
+	doc->gapLen = INITIAL_TEXT_GAP;
+	doc->text = (char*) safeAlloc(doc->gapLen + 1);
+	doc->text[0] = doc->text[doc->gapLen] = '\0';
+	doc->tokens = tokenize(doc->text);
+	// retokenize updates the lines of the text, so they are known before the first edit
+	tkLine(doc->tokens, 0);
+	astInit(&doc->ast);
+
+	// the global domain of the document, with the external functions
+	Domain *saved = symTable;
+	symTable = NULL;
+	doc->global = pushDomain();
+	vmInit();
+	doc->builtins = doc->global->lastSymbol;
+	symTable = saved;
+
+	// all the text is an edit of the empty document
+	docEdit(doc, 0, 0, text, len);
+	return doc;
+}
+
+void docEdit(Doc *doc, int start, int end, const char *text, int len) {
+	// the removed chars join the gap and the new ones are added at its start
+	moveTextGap(doc, start);
+	doc->gapLen += end - start;
+	doc->len -= end - start;
+	if (doc->gapLen <= len) {
+		int size = doc->len + doc->gapLen + 1, nAfter = doc->len - doc->gap;
+		int newSize = doc->len + len + 1 > size ? 2 * (doc->len + len + 1) : 2 * size;
+		doc->text = safeRealloc(doc->text, newSize);
+		// with the final '\0'
+		memmove(doc->text + newSize - nAfter - 1, doc->text + size - nAfter - 1, nAfter + 1);
+		doc->gapLen = newSize - doc->len - 1;
+	}
+	memcpy(doc->text + doc->gap, text, len);
+	doc->gap += len;
+	doc->gapLen -= len;
+	doc->len += len;
+	doc->text[doc->gap] = '\0';
+	addPending(doc, start, end, len);
+	update(doc);
+}
+
+int docDiagnostics(Doc *doc, const Diagnostic **diags) {
+	if (doc->capDiags < doc->nErrors + 1) {
+		doc->capDiags = doc->nErrors + 1;
+		doc->diags = safeRealloc(doc->diags, doc->capDiags * sizeof(Diagnostic));
+	}
+	int n = 0;
+	if (doc->lexMsg) {
+		// the items are from an older text
+		doc->diags[n++] = (Diagnostic) { doc->lexLine, doc->lexMsg };
+	} else {
+		int nFree = doc->capErrors - doc->nErrors;
+		for (int i = 0; i < doc->nErrors; ++i) {
+			DocError *e = &doc->errors[i < doc->errorGap ? i : i + nFree];
+			int tk = i < doc->errorGap ? e->tk : e->tk + doc->tokens->n;
+			doc->diags[n++] = (Diagnostic) { tkLine(doc->tokens, tk), e->msg };
+		}
+	}
+	*diags = doc->diags;
+	return n;
+}
+
+void docClose(Doc *doc) {
+	// the symbols of the items after the gap are added back, so they are freed with the global domain
+	moveItemGap(doc, doc->nItems, doc->tokens->n);
+	Domain *saved = symTable;
+	symTable = doc->global;
+	dropDomain();
+	symTable = saved;
+	for (int i = 0; i < doc->nErrors; ++i) {
+		free(doc->errors[i].msg);
+	}
+	astFree(&doc->ast);
+	parseEnd();
+	free(doc->items);
+	free(doc->errors);
+	free(doc->diags);
+	free(doc->lexMsg);
+	freeTokens(doc->tokens);
+	free(doc->text);
+	free(doc);
+}
+
+char *copyText(const char *s) {
+	size_t n = strlen(s) + 1;
+	return memcpy(safeAlloc(n), s, n);
+}
+
+void moveTextGap(Doc *doc, int pos) {
+	if (pos < doc->gap) {
+		memmove(doc->text + pos + doc->gapLen, doc->text + pos, doc->gap - pos);
+	} else {
+		memmove(doc->text + doc->gap, doc->text + doc->gap + doc->gapLen, pos - doc->gap);
+	}
+	doc->gap = pos;
+	doc->text[pos] = '\0';
+}
+
+void addPending(Doc *doc, int start, int end, int len) {
+	if (!doc->pending) {
+		doc->pending = true;
+		doc->pendingStart = start;
+		doc->pendingOldEnd = end;
+		doc->pendingNewEnd = start + len;
+		return;
+	}
+	// the pending changes grow to contain the edit; the chars after them are not changed
+	if (end > doc->pendingNewEnd) {
+		doc->pendingOldEnd += end - doc->pendingNewEnd;
+		doc->pendingNewEnd = end;
+	}
+	doc->pendingNewEnd += len - (end - start);
+	if (start < doc->pendingStart) {
+		doc->pendingStart = start;
+	}
+}
+
+void update(Doc *doc) {
+	Domain *saved = symTable;
+	symTable = doc->global;
+	int nOld = doc->tokens->n;
+	int i0, nRemoved, nAdded;
+	if (relex(doc, &i0, &nRemoved, &nAdded) && (nRemoved || nAdded)) {
+		// the first changed item, or the item before it if the changed tokens could complete it
+		// (an item with an error also depends on the token after it)
+		int k0 = firstItemAt(doc, i0, nOld);
+		if (k0 > 0 && (itemTk(doc, k0 - 1, itemAt(doc, k0 - 1)->endTk, nOld) > i0 || itemAt(doc, k0 - 1)->failed)) {
+			--k0;
+		}
+		int kc = firstItemAt(doc, i0 + nRemoved, nOld);
+		// the items before k0 have only tokens before the changed ones and the items from kc only tokens after them,
+		// so the gap between them makes their indexes right for the new tokens
+		moveItemGap(doc, kc, nOld);
+		int pos = k0 < kc && itemAt(doc, k0)->firstTk < i0 ? itemAt(doc, k0)->firstTk : i0;
+		reparse(doc, k0, kc, pos);
+	}
+	symTable = saved;
+}
+
+bool relex(Doc *doc, int *i0, int *nRemoved, int *nAdded) {
+	// the edited lines are scanned before the gap, so it is moved to their end; the pending changes end after it
+	int n = editedLinesEnd(doc->text + doc->gapLen + doc->pendingNewEnd);
+	moveTextGap(doc, n < 0 ? doc->len : doc->pendingNewEnd + n);
+	ErrTrap trap;
+	ErrTrap *saved = errTrap;
+	errTrap = &trap;
+	if (setjmp(trap.env)) {
+		errTrap = saved;
+		free(doc->lexMsg);
+		doc->lexMsg = copyText(trap.msg);
+		doc->lexLine = trap.line;
+		return false;
+	}
+	*i0 = retokenize(doc->tokens, doc->text, doc->text + doc->len + doc->gapLen,
+		doc->pendingStart, doc->pendingOldEnd, doc->pendingNewEnd, nRemoved, nAdded);
+	errTrap = saved;
+	free(doc->lexMsg);
+	doc->lexMsg = NULL;
+	doc->pending = false;
+	return true;
+}
+
+DocItem *itemAt(Doc *doc, int k) {
+	return &doc->items[k < doc->itemGap ? k : k + doc->capItems - doc->nItems];
+}
+
+int itemTk(Doc *doc, int k, int tk, int nTks) {
+	return k < doc->itemGap ? tk : tk + nTks;
+}
+
+int firstItemAt(Doc *doc, int idx, int nTks) {
+	int left = 0, right = doc->nItems;
+	while (left < right) {
+		int mid = (left + right) / 2;
+		if (itemTk(doc, mid, itemAt(doc, mid)->firstTk, nTks) < idx) {
+			left = mid + 1;
+		} else {
+			right = mid;
+		}
+	}
+	return left;
+}
+
+Symbol *symbolBefore(Doc *doc, int k) {
+	while (--k >= 0) {
+		if (itemAt(doc, k)->symbol) {
+			return itemAt(doc, k)->symbol;
+		}
+	}
+	return doc->builtins;
+}
+
+void moveItemGap(Doc *doc, int k, int nTks) {
+	int nFree = doc->capItems - doc->nItems, nFreeErrors = doc->capErrors - doc->nErrors;
+	if (k < doc->itemGap) {
+		// the symbols of the items before the gap are the last ones of the global domain, in the same order
+		cutDomain(doc->global, symbolBefore(doc, k));
+	}
+	while (doc->itemGap > k) {
+		int i = --doc->itemGap;
+		DocItem *item = &doc->items[i + nFree];
+		*item = doc->items[i];
+		item->firstTk -= nTks;
+		item->endTk -= nTks;
+		if (item->failed) {
+			int e = --doc->errorGap;
+			doc->errors[e + nFreeErrors] = doc->errors[e];
+			doc->errors[e + nFreeErrors].tk -= nTks;
+		}
+	}
+	for (; doc->itemGap < k; ++doc->itemGap) {
+		int i = doc->itemGap;
+		DocItem *item = &doc->items[i];
+		*item = doc->items[i + nFree];
+		item->firstTk += nTks;
+		item->endTk += nTks;
+		if (item->symbol) {
+			addSymbolToDomain(doc->global, item->symbol);
+		}
+		if (item->failed) {
+			int e = doc->errorGap++;
+			doc->errors[e] = doc->errors[e + nFreeErrors];
+			doc->errors[e].tk += nTks;
+		}
+	}
+}
+
+void *growGapped(void *array, int n, int *cap, int gap, size_t size) {
+	int oldCap = *cap, nAfter = n - gap;
+	*cap = oldCap ? oldCap * 2 : 8;
+	char *p = safeRealloc(array, *cap * size);
+	memmove(p + (*cap - nAfter) * size, p + (oldCap - nAfter) * size, nAfter * size);
+	return p;
+}
+
+void reparse(Doc *doc, int k0, int kc, int pos) {
+	Reparse r;
+	memset(&r, 0, sizeof(r));
+
+	// the items from k0 are the last ones before the gap, so their symbols are the last ones of the global domain
+	for (Symbol *s = cutDomain(doc->global, symbolBefore(doc, k0)), *next; s; s = next) {
+		next = s->next;
+		s->next = NULL;
+		addRemoved(&r, s);
+	}
+	while (doc->itemGap > k0) {
+		doc->nItems--;
+		if (doc->items[--doc->itemGap].failed) {
+			doc->nErrors--;
+			free(doc->errors[--doc->errorGap].msg);
+		}
+	}
+
+	int endTk = doc->tokens->n - 1;		// END
+	bool cascade = false;				// true if all the next items must be parsed again
+	for (;;) {
+		// the old items which start inside the parsed items are gone
+		int next = doc->itemGap;		// the first item which was not parsed again
+		while (next < doc->nItems && itemTk(doc, next, itemAt(doc, next)->firstTk, doc->tokens->n) < pos) {
+			takeNext(doc, &r);
+			cascade = true;
+		}
+		if (next < doc->nItems && itemTk(doc, next, itemAt(doc, next)->firstTk, doc->tokens->n) == pos) {
+			// the parsing is back in sync with the old items, which stay if the removed symbols are defined again the same
+			for (int i = 0; i < r.nRemoved && !cascade; ++i) {
+				cascade = !r.matched[i];
+			}
+			if (!cascade) {
+				break;
+			}
+			takeNext(doc, &r);
+		}
+		if (pos == endTk) {
+			break;
+		}
+		DocItem *item = parseItem(doc, pos);
+		if (item->symbol) {
+			int i = 0;
+			while (i < r.nRemoved && (r.matched[i] || r.removed[i]->name != item->symbol->name)) {
+				++i;
+			}
+			if (i < r.nRemoved && sameInterface(r.removed[i], item->symbol)) {
+				r.matched[i] = true;
+			} else {
+				cascade = true;
+			}
+		}
+		pos = item->endTk;
+	}
+
+	for (int i = 0; i < r.nRemoved; ++i) {
+		freeSymbol(doc->global, r.removed[i]);
+	}
+	free(r.removed);
+	free(r.matched);
+}
+
+void addRemoved(Reparse *r, Symbol *s) {
+	if (r->nRemoved == r->capRemoved) {
+		r->capRemoved = r->capRemoved ? r->capRemoved * 2 : 8;
+		r->removed = safeRealloc(r->removed, r->capRemoved * sizeof(Symbol*));
+		r->matched = safeRealloc(r->matched, r->capRemoved * sizeof(bool));
+	}
+	r->removed[r->nRemoved] = s;
+	r->matched[r->nRemoved++] = false;
+}
+
+void takeNext(Doc *doc, Reparse *r) {
+	DocItem *item = itemAt(doc, doc->itemGap);
+	// its symbol is not in the global domain
+	if (item->symbol) {
+		addRemoved(r, item->symbol);
+	}
+	if (item->failed) {
+		free(doc->errors[doc->errorGap + doc->capErrors - doc->nErrors].msg);
+		doc->nErrors--;
+	}
+	doc->nItems--;
+}
+
+DocItem *parseItem(Doc *doc, int pos) {
+	if (doc->nItems == doc->capItems) {
+		doc->items = growGapped(doc->items, doc->nItems, &doc->capItems, doc->itemGap, sizeof(DocItem));
+	}
+	DocItem *item = &doc->items[doc->itemGap++];
+	doc->nItems++;
+	item->firstTk = pos;
+	item->failed = false;
+	Symbol *last = doc->global->lastSymbol;
+	ErrTrap trap;
+	ErrTrap *saved = errTrap;
+	errTrap = &trap;
+	if (setjmp(trap.env)) {
+		// the domains opened by the item are closed
+		while (symTable != doc->global) {
+			dropDomain();
+		}
+		item->failed = true;
+		addError(doc, parseErrorTk(), copyText(trap.msg));
+		item->endTk = skipTopLevel(doc->tokens, pos);
+	} else {
+		astClear(&doc->ast);
+		item->endTk = parseTopLevel(doc->tokens, pos, &doc->ast);
+	}
+	errTrap = saved;
+	// a function with an error in its body is still defined
+	item->symbol = doc->global->lastSymbol != last ? doc->global->lastSymbol : NULL;
+	return item;
+}
+
+void addError(Doc *doc, int tk, char *msg) {
+	if (doc->nErrors == doc->capErrors) {
+		doc->errors = growGapped(doc->errors, doc->nErrors, &doc->capErrors, doc->errorGap, sizeof(DocError));
+	}
+	doc->errors[doc->errorGap++] = (DocError) { tk, msg };
+	doc->nErrors++;
+}
+
+bool sameInterface(Symbol *a, Symbol *b) {
+	// the types of the next items point to the struct symbols, so a new struct is never the same
+	if (a->name != b->name || a->kind != b->kind || a->kind == SK_STRUCT || a->type != b->type) {
+		return false;
+	}
+	if (a->kind == SK_FN) {
+		if (a->fn.nParams != b->fn.nParams) {
+			return false;
+		}
+		for (int i = 0; i < a->fn.nParams; ++i) {
+			if (a->fn.params[i]->type != b->fn.params[i]->type) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
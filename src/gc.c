@@ -0,0 +1,599 @@
+#include "gc.h"
+#include "at.h"
+#include "lexer.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <setjmp.h>
+
+// the number of calls and jumps which a call evaluated at compile time can do
+#define EVAL_BUDGET 100000
+
+/*
+	The frame of a function, relative to FP:
+		the parameters, in their order, ending at FP[-2]
+		FP[-1] - the return address
+		FP[0] - the old FP
+		the local variables, from FP[1]
+	A scalar takes a cell. An array parameter is the address of its first element.
+	The local arrays and structs, and the struct parameters, take as many cells as their bytes need.
+	In memory (global variables, arrays, structs) the values have the layout given by typeSize.
+*/
+
+// the state of the code generation, for each thread
+static _Thread_local Ast *ast;				// the tree of the generated functions
+static _Thread_local Symbol *fn;			// the function being generated
+static _Thread_local Instr *last;			// the last instruction of fn
+static _Thread_local int *paramOffsets;		// the index from FP of each parameter, by paramIdx
+static _Thread_local int *localOffsets;		// the index from FP of each local variable, by varIdx
+static _Thread_local int nParamCells;		// the number of cells of all the parameters
+
+/*
+	the jumps to the next added instruction
+	a jump forward is added before its destination, so it waits here until the destination is added
+*/
+static _Thread_local Instr **pending;
+static _Thread_local int nPending;
+static _Thread_local int capPending;
+
+// the node with the given index
+#define NODE(id) astNode(ast, id)
+
+static void genFn(Node *node);
+// stops with an error if the code of the function f cannot be generated
+static void checkFn(Symbol *f);
+static void genStm(NodeId id);
+// generates the value of a condition, as an int
+static void genCond(NodeId id);
+// generates the value of an expression: a scalar, the address of an array or the address of a struct
+static void genRval(NodeId id);
+// generates the address of an expression which is in memory
+static void genAddr(NodeId id);
+static void genAssign(NodeId id, bool keepValue);
+static void genLogic(Node *node);
+static void genCall(Node *node);
+// true if the call can be evaluated at compile time: its arguments are literals or such calls
+static bool isConstCall(Node *node);
+// runs the call on the sandbox; returns false if it has side effects or if it cannot be run
+static bool evalCall(Vm *sandbox, ConstCall *c, Val *result);
+// converts the scalar value from stack from the type src to the type dst
+static void genConv(TypeId src, TypeId dst);
+
+// adds an instruction after the last one and makes it the destination of the pending jumps
+static Instr *emit(Opcode op);
+static Instr *emitInt(Opcode op, int i);
+// makes the next added instruction the destination of the jump
+static void jumpToNext(Instr *jump);
+
+// true if the symbol is a scalar which is kept in a cell of the frame
+static bool inFrame(Symbol *s);
+// the number of stack cells of a value of type t
+static int cellsOf(TypeId t);
+static bool isScalar(TypeId t);
+
+void genCode(Ast *tree) {
+	ast = tree;
+	// the functions which cannot be generated are found before any memory is allocated
+	for (NodeId id = ast->fns; id != NO_NODE; id = NODE(id)->next) {
+		checkFn(NODE(id)->sym);
+	}
+	for (NodeId id = ast->fns; id != NO_NODE; id = NODE(id)->next) {
+		genFn(NODE(id));
+	}
+	free(pending);
+	pending = NULL;
+	capPending = 0;
+	for (NodeId id = ast->fns; id != NO_NODE; id = NODE(id)->next) {
+		foldCalls(NODE(id)->sym);
+	}
+}
+
+void genFunction(Ast *tree, NodeId id) {
+	ast = tree;
+	checkFn(NODE(id)->sym);
+	genFn(NODE(id));
+	free(pending);
+	pending = NULL;
+	capPending = 0;
+}
+
+void checkFn(Symbol *f) {
+	if (typeOf(f->type)->cls == TC_STRUCT) {
+		// its value would be the address of a struct from its own frame
+		err("The function %s returns a struct, which is not supported by the code generation", f->name->text);
+	}
+}
+
+void genEntry(Symbol *f) {
+	addInstr(&f->fn.instr, OP_ENTER);
+}
+
+void genLazyEntry(Symbol *f, void *lazy) {
+	if (!f->fn.instr) {
+		genEntry(f);
+	}
+	f->fn.instr->op = OP_LAZY;
+	f->fn.instr->arg.p = lazy;
+}
+
+Instr *genProgram(Symbol *mainFn) {
+	if (mainFn->fn.nParams) {
+		err("The function %s must have no parameters to be run", mainFn->name->text);
+	}
+	Instr *code = NULL;
+	Instr *call = addInstr(&code, mainFn->fn.extFnPtr ? OP_CALL_EXT : OP_CALL);
+	if (mainFn->fn.extFnPtr) {
+		call->arg.extFnPtr = mainFn->fn.extFnPtr;
+	} else {
+		call->arg.instr = mainFn->fn.instr;
+	}
+	addInstr(&code, OP_HALT);
+	return code;
+}
+
+void genFn(Node *node) {
+	fn = node->sym;
+	NodeId body = node->a;
+
+	// the frame layout
+	int nParams = fn->fn.nParams, nLocals = fn->fn.nLocals;
+	paramOffsets = safeAlloc((nParams + 1) * sizeof(int));
+	localOffsets = safeAlloc((nLocals + 1) * sizeof(int));
+	nParamCells = 0;
+	for (int i = 0; i < nParams; ++i) {
+		paramOffsets[i] = nParamCells;
+		nParamCells += cellsOf(fn->fn.params[i]->type);
+	}
+	for (int i = 0; i < nParams; ++i) {
+		paramOffsets[i] -= nParamCells + 1;
+	}
+	int nLocalCells = 0;
+	for (int i = 0; i < nLocals; ++i) {
+		localOffsets[i] = nLocalCells + 1;
+		nLocalCells += cellsOf(fn->fn.locals[i]->type);
+	}
+
+	// a recursive call needs the first instruction before the body is generated
+	if (fn->fn.instr) {
+		// made by genEntry or genLazyEntry
+		last = fn->fn.instr;
+		last->op = OP_ENTER;
+		last->arg.i = nLocalCells;
+	} else {
+		last = NULL;
+		fn->fn.instr = emitInt(OP_ENTER, nLocalCells);
+	}
+	genStm(body);
+
+	// the end of the function, reached without a return
+	if (fn->type == TY_VOID) {
+		emitInt(OP_RET_VOID, nParamCells);
+	} else {
+		if (fn->type == TY_DOUBLE) {
+			emit(OP_PUSH_F)->arg.f = 0;
+		} else {
+			emitInt(OP_PUSH_I, 0);
+		}
+		emitInt(OP_RET, nParamCells);
+	}
+	free(paramOffsets);
+	free(localOffsets);
+}
+
+void genStm(NodeId id) {
+	Node *node = NODE(id);
+	switch (node->kind) {
+		case N_BLOCK:
+			for (NodeId s = node->a; s != NO_NODE; s = NODE(s)->next) {
+				genStm(s);
+			}
+			break;
+		case N_IF: {
+			genCond(node->a);
+			Instr *jfElse = emit(OP_JF);
+			genStm(node->b);
+			if (node->c != NO_NODE) {
+				Instr *jmpEnd = emit(OP_JMP);
+				jumpToNext(jfElse);
+				genStm(node->c);
+				jumpToNext(jmpEnd);
+			} else {
+				jumpToNext(jfElse);
+			}
+			break;
+		}
+		case N_WHILE: {
+			Instr *before = last;
+			genCond(node->a);
+			Instr *start = before->next;
+			Instr *jfEnd = emit(OP_JF);
+			genStm(node->b);
+			emit(OP_JMP)->arg.instr = start;
+			jumpToNext(jfEnd);
+			break;
+		}
+		case N_RETURN:
+			if (node->a != NO_NODE) {
+				genRval(node->a);
+				genConv(NODE(node->a)->type, fn->type);
+				emitInt(OP_RET, nParamCells);
+			} else {
+				emitInt(OP_RET_VOID, nParamCells);
+			}
+			break;
+		case N_EXPR:
+			if (node->a == NO_NODE) {
+				break;
+			}
+			// the value of the expression is not used
+			if (NODE(node->a)->kind == N_ASSIGN) {
+				genAssign(node->a, false);
+			} else {
+				genRval(node->a);
+				if (NODE(node->a)->type != TY_VOID) {
+					emit(OP_DROP);
+				}
+			}
+			break;
+		default:
+			err("Code generation: %d is not a statement", node->kind);
+	}
+}
+
+void genCond(NodeId id) {
+	genRval(id);
+	if (NODE(id)->type == TY_DOUBLE) {
+		emit(OP_PUSH_F)->arg.f = 0;
+		emit(OP_NOTEQ_F);
+	}
+}
+
+void genRval(NodeId id) {
+	Node *node = NODE(id);
+	switch (node->kind) {
+		case N_INT:
+			emitInt(OP_PUSH_I, node->i);
+			return;
+		case N_DOUBLE:
+			emit(OP_PUSH_F)->arg.f = node->d;
+			return;
+		case N_CHAR:
+			emitInt(OP_PUSH_I, node->ch);
+			return;
+		case N_STRING:
+			emit(OP_ADDR)->arg.p = (void*) node->str.chars;
+			return;
+		case N_VAR:
+			if (inFrame(node->sym)) {
+				Symbol *s = node->sym;
+				emitInt(OP_FPLOAD, s->kind == SK_PARAM ? paramOffsets[s->paramIdx] : localOffsets[s->varIdx]);
+				return;
+			}
+			break;
+		case N_CALL:
+			genCall(node);
+			return;
+		case N_NEG:
+			genRval(node->a);
+			emit(node->type == TY_DOUBLE ? OP_NEG_F : OP_NEG_I);
+			return;
+		case N_NOT:
+			genRval(node->a);
+			emit(NODE(node->a)->type == TY_DOUBLE ? OP_NOT_F : OP_NOT_I);
+			return;
+		case N_CAST:
+			genRval(node->a);
+			if (isScalar(node->type)) {
+				genConv(NODE(node->a)->type, node->type);
+			}
+			return;
+		case N_ASSIGN:
+			genAssign(id, true);
+			return;
+		case N_BINARY: {
+			if (node->op == AND || node->op == OR) {
+				genLogic(node);
+				return;
+			}
+			// both operands are converted to the type of the operation
+			TypeId t;
+			arithTypeTo(NODE(node->a)->type, NODE(node->b)->type, &t);
+			genRval(node->a);
+			genConv(NODE(node->a)->type, t);
+			genRval(node->b);
+			genConv(NODE(node->b)->type, t);
+			bool f = t == TY_DOUBLE;
+			Opcode op;
+			switch (node->op) {
+				case ADD: op = f ? OP_ADD_F : OP_ADD_I; break;
+				case SUB: op = f ? OP_SUB_F : OP_SUB_I; break;
+				case MUL: op = f ? OP_MUL_F : OP_MUL_I; break;
+				case DIV: op = f ? OP_DIV_F : OP_DIV_I; break;
+				case EQUAL: op = f ? OP_EQUAL_F : OP_EQUAL_I; break;
+				case NOTEQ: op = f ? OP_NOTEQ_F : OP_NOTEQ_I; break;
+				case LESS: op = f ? OP_LESS_F : OP_LESS_I; break;
+				case LESSEQ: op = f ? OP_LESSEQ_F : OP_LESSEQ_I; break;
+				case GREATER: op = f ? OP_GREATER_F : OP_GREATER_I; break;
+				default: op = f ? OP_GREATEREQ_F : OP_GREATEREQ_I; break;	// GREATEREQ
+			}
+			emit(op);
+			return;
+		}
+		default:
+			break;
+	}
+	// a variable, an element or a field from memory: a scalar is loaded, else its address is its value
+	genAddr(id);
+	if (isScalar(node->type)) {
+		switch (typeOf(node->type)->tb) {
+			case TB_INT: emit(OP_LOAD_I); break;
+			case TB_DOUBLE: emit(OP_LOAD_F); break;
+			default: emit(OP_LOAD_C); break;	// TB_CHAR
+		}
+	}
+}
+
+void genAddr(NodeId id) {
+	Node *node = NODE(id);
+	switch (node->kind) {
+		case N_VAR: {
+			Symbol *s = node->sym;
+			if (s->kind == SK_PARAM) {
+				// an array parameter is already an address
+				emitInt(typeOf(s->type)->cls == TC_ARRAY ? OP_FPLOAD : OP_FPADDR, paramOffsets[s->paramIdx]);
+			} else if (s->owner) {
+				emitInt(OP_FPADDR, localOffsets[s->varIdx]);
+			} else {
+				emitInt(OP_GADDR, s->varIdx);
+			}
+			break;
+		}
+		case N_INDEX: {
+			genRval(node->a);
+			genRval(node->b);
+			genConv(NODE(node->b)->type, TY_INT);
+			emitInt(OP_INDEX, typeSize(node->type));
+			break;
+		}
+		case N_FIELD:
+			genRval(node->a);
+			if (node->sym->varIdx) {
+				emitInt(OP_OFFSET, node->sym->varIdx);
+			}
+			break;
+		default:
+			err("Code generation: %d has no address", node->kind);
+	}
+}
+
+void genAssign(NodeId id, bool keepValue) {
+	Node *node = NODE(id);
+	Node *dst = NODE(node->a);
+	genRval(node->b);
+	genConv(NODE(node->b)->type, dst->type);
+	// a struct is copied from the address of the source, which is also its value
+	if (keepValue) {
+		emit(OP_DUP);
+	}
+	if (dst->kind == N_VAR && inFrame(dst->sym)) {
+		Symbol *s = dst->sym;
+		emitInt(OP_FPSTORE, s->kind == SK_PARAM ? paramOffsets[s->paramIdx] : localOffsets[s->varIdx]);
+		return;
+	}
+	genAddr(node->a);
+	switch (typeOf(dst->type)->tb) {
+		case TB_INT: emit(OP_STORE_I); break;
+		case TB_DOUBLE: emit(OP_STORE_F); break;
+		case TB_STRUCT: emitInt(OP_STORE_S, typeSize(dst->type)); break;
+		default: emit(OP_STORE_C); break;	// TB_CHAR
+	}
+}
+
+void genLogic(Node *node) {
+	// the second operand is evaluated only if the first one does not give the result
+	Opcode jump = node->op == AND ? OP_JF : OP_JT;
+	genCond(node->a);
+	Instr *j1 = emit(jump);
+	genCond(node->b);
+	Instr *j2 = emit(jump);
+	emitInt(OP_PUSH_I, node->op == AND);
+	Instr *jmpEnd = emit(OP_JMP);
+	jumpToNext(j1);
+	jumpToNext(j2);
+	emitInt(OP_PUSH_I, node->op != AND);
+	jumpToNext(jmpEnd);
+}
+
+void genCall(Node *node) {
+	Symbol *f = node->sym;
+	Instr *before = last;
+	int i = 0;
+	for (NodeId arg = node->a; arg != NO_NODE; arg = NODE(arg)->next) {
+		Symbol *param = f->fn.params[i++];
+		genRval(arg);
+		if (typeOf(param->type)->cls == TC_STRUCT) {
+			// a struct is passed by value
+			emitInt(OP_COPY, typeSize(param->type));
+		} else if (isScalar(param->type)) {
+			genConv(NODE(arg)->type, param->type);
+		}
+	}
+	if (f->fn.extFnPtr) {
+		emit(OP_CALL_EXT)->arg.extFnPtr = f->fn.extFnPtr;
+	} else {
+		emit(OP_CALL)->arg.instr = f->fn.instr;
+	}
+	if (isConstCall(node)) {
+		// the called functions can be generated later, so the call is evaluated after all of them, by foldCalls
+		if (fn->fn.nConstCalls % 16 == 0) {
+			fn->fn.constCalls = safeRealloc(fn->fn.constCalls, (fn->fn.nConstCalls + 16) * sizeof(ConstCall));
+		}
+		fn->fn.constCalls[fn->fn.nConstCalls++] = (ConstCall) { before->next, last, f };
+	}
+}
+
+bool isConstCall(Node *node) {
+	Symbol *f = node->sym;
+	// a void function has no result to put in place of its call
+	if (f->fn.extFnPtr || f->type == TY_VOID || !isScalar(f->type)) {
+		return false;
+	}
+	for (NodeId arg = node->a; arg != NO_NODE; arg = NODE(arg)->next) {
+		switch (NODE(arg)->kind) {
+			case N_INT:
+			case N_DOUBLE:
+			case N_CHAR:
+				break;
+			case N_CALL:
+				if (isConstCall(NODE(arg))) {
+					break;
+				}
+				return false;
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+void foldCalls(Symbol *f) {
+	Vm *sandbox = NULL;
+	for (int k = 0; k < f->fn.nConstCalls; ++k) {
+		ConstCall *c = &f->fn.constCalls[k];
+		// a function which is generated on its first call is not generated for an evaluation
+		if (c->fn->fn.noEval || c->fn->fn.instr->op == OP_LAZY) {
+			continue;
+		}
+		if (!sandbox) {
+			sandbox = newVm(NULL);
+			sandbox->sandbox = true;
+		}
+		Val result;
+		if (!evalCall(sandbox, c, &result)) {
+			continue;
+		}
+		// the first instruction stays, because the jumps before the call can go to it
+		Instr *after = c->call->next;
+		if (c->first != c->call) {
+			Instr *removed = c->first->next;
+			c->call->next = NULL;
+			freeInstrs(removed);
+		}
+		c->first->next = after;
+		c->first->op = c->fn->type == TY_DOUBLE ? OP_PUSH_F : OP_PUSH_I;
+		c->first->arg = result;
+	}
+	if (sandbox) {
+		freeVm(sandbox);
+	}
+	free(f->fn.constCalls);
+	f->fn.constCalls = NULL;
+	f->fn.nConstCalls = 0;
+}
+
+bool evalCall(Vm *sandbox, ConstCall *c, Val *result) {
+	// the program is a copy of the call, followed by HALT
+	Instr *program = NULL, *i = c->first;
+	for (;; i = i->next) {
+		if (i->op == OP_CALL && i != c->call) {
+			// an argument is a call which was not evaluated, so this call cannot be evaluated either
+			freeInstrs(program);
+			return false;
+		}
+		addInstr(&program, i->op)->arg = i->arg;
+		if (i == c->call) {
+			break;
+		}
+	}
+	addInstr(&program, OP_HALT);
+
+	ErrTrap trap;
+	ErrTrap *saved = errTrap;
+	errTrap = &trap;
+	if (setjmp(trap.env)) {
+		errTrap = saved;
+		freeInstrs(program);
+		// a function which cannot be evaluated is not tried again, so it costs at most one budget
+		c->fn->fn.noEval = true;
+		return false;
+	}
+	sandbox->SP = sandbox->stack - 1;
+	sandbox->FP = NULL;
+	sandbox->budget = EVAL_BUDGET;
+	run(sandbox, program);
+	errTrap = saved;
+	freeInstrs(program);
+	*result = *sandbox->SP;
+	return true;
+}
+
+void genConv(TypeId srcId, TypeId dstId) {
+	const Type *src = typeOf(srcId), *dst = typeOf(dstId);
+	if (src->tb == dst->tb) {
+		return;
+	}
+	switch (dst->tb) {
+		case TB_DOUBLE:
+			emit(OP_CONV_I_F);
+			break;
+		case TB_INT:
+			if (src->tb == TB_DOUBLE) {
+				emit(OP_CONV_F_I);
+			}
+			break;
+		case TB_CHAR:
+			if (src->tb == TB_DOUBLE) {
+				emit(OP_CONV_F_I);
+			}
+			emit(OP_CONV_I_C);
+			break;
+		default:
+			break;
+	}
+}
+
+Instr *emit(Opcode op) {
+	Instr *i;
+	if (last) {
+		i = insertInstr(last, op);
+	} else {
+		i = NULL;
+		addInstr(&i, op);
+	}
+	for (int k = 0; k < nPending; ++k) {
+		pending[k]->arg.instr = i;
+	}
+	nPending = 0;
+	last = i;
+	return i;
+}
+
+Instr *emitInt(Opcode op, int i) {
+	Instr *instr = emit(op);
+	instr->arg.i = i;
+	return instr;
+}
+
+void jumpToNext(Instr *jump) {
+	if (nPending == capPending) {
+		capPending = capPending ? capPending * 2 : 16;
+		pending = safeRealloc(pending, capPending * sizeof(Instr*));
+	}
+	pending[nPending++] = jump;
+}
+
+bool inFrame(Symbol *s) {
+	return (s->kind == SK_PARAM || s->owner) && isScalar(s->type);
+}
+
+int cellsOf(TypeId t) {
+	if (typeOf(t)->n == 0 || isScalar(t)) {
+		return 1;
+	}
+	return (typeSize(t) + sizeof(Val) - 1) / sizeof(Val);
+}
+
+bool isScalar(TypeId t) {
+	TypeClass cls = typeOf(t)->cls;
+	return cls != TC_ARRAY && cls != TC_STRUCT;
+}
@@ -1,36 +1,169 @@
 #include "lexer.h"
 #include "utils.h"
+#include "scan.h"
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define INITIAL_TOKENS_CAP 1024
+#define INITIAL_STREAM_CAP 64
+#define MIN_CHUNK_SIZE (256 * 1024)	// smaller sources are not worth splitting between threads
+#define MAX_CHUNKS 64
+
+/*
+	Table-driven scanner
+	Every char is mapped to a char class and the DFA moves from a state to the next one
+	using the transition table, until there is no transition for the current char.
+	The token is given by the state where the DFA stopped.
+	The keywords are states of the automaton, so they are recognized without comparing strings.
+	The tables are generated by buildTables from the lexical rules (README.md).
+	The states which loop on themselves over long runs of chars (identifiers, numbers, comments,
+	strings, whitespace) skip the rest of the run with a SIMD kernel (scan.h).
+*/
 
 // valid escape characters
 static const char *ESCAPE_CHARS = "nrt\\\'\"";
 
-static Token *tokens;	// single linked list of tokens
-static Token *lastTk;	// the last token in the list
+// the chars which can start (and continue) an identifier
+static const char *ID_CHARS = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+static const char *DIGITS = "0123456789";
+
+// the keywords and their codes
+static const char *KEYWORDS[] = { "int", "char", "double", "if", "else", "while", "void", "return", "struct" };
+static const int KEYWORD_CODES[] = { TYPE_INT, TYPE_CHAR, TYPE_DOUBLE, IF, ELSE, WHILE, VOID, RETURN, STRUCT };
+#define NUM_KEYWORDS ((int) (sizeof(KEYWORDS) / sizeof(KEYWORDS[0])))
+
+// the fixed states of the DFA; the states of the keywords come after S_KEYWORDS
+enum
+{
+	S_DEAD = 0,		// no transition
+	S_START,
+	S_SPACE, S_SLASH, S_COMMENT,
+	S_COMMA, S_SEMICOLON, S_LPAR, S_RPAR, S_LBRACKET, S_RBRACKET, S_LACC, S_RACC,
+	S_ADD, S_SUB, S_MUL, S_DOT, S_AMP, S_AND, S_PIPE, S_OR, S_NOT, S_NOTEQ,
+	S_ASSIGN, S_EQUAL, S_LESS, S_LESSEQ, S_GREATER, S_GREATEREQ,
+	S_ID,
+	S_INT, S_FRAC0, S_FRAC, S_EXP0, S_EXPSIGN, S_EXP,
+	S_CHAR0, S_CHAR_ESC, S_CHAR1, S_CHAR_END,
+	S_STR, S_STR_ESC, S_STR_END,
+	S_KEYWORDS
+};
+
+#define MAX_STATES 96
+#define MAX_CLASSES 64
+
+// the pseudo-codes of the states which do not produce a token
+#define TK_SKIP (-1)	// whitespace and comments
+#define TK_ERROR (-2)	// the input cannot end in this state
+
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;	// the tables are built by the first thread which needs them
+static unsigned char charClass[256];					// the class of each char
+static int numClasses;
+static unsigned char trans[MAX_STATES][MAX_CLASSES];	// the next state, S_DEAD for none
+static int accept[MAX_STATES];							// the token code for each state, TK_SKIP or TK_ERROR
+static unsigned char skipKind[MAX_STATES];				// the kernel which continues each state (SKIP_*)
+static int numStates;
+
+/*
+	A chunk of the source, tokenized by its own thread (tokenizeParallel).
+	A chunk starts at the beginning of a line, so its first token is also a token for the whole source.
+	The tokens which start in the chunk are scanned entirely, even if they go past its end.
+*/
+typedef struct
+{
+	Tokens *tokens;			// the tokens of the chunk, with the offsets from the whole source
+	const char *end;		// the char after the chunk
+	pthread_t thread;
+	jmp_buf onError;		// where a lexical error stops the chunk
+	int errState;			// the state of the first lexical error, S_DEAD if none
+	const char *errStart;
+	const char *errPch;
+} Chunk;
+
+// the tokens being built and the chunk being scanned (NULL for sequential scanning), for each thread
+static _Thread_local Tokens *tokens;
+static _Thread_local Chunk *chunk;
+
+// generates the char classes and the DFA tables
+static void buildTables();
+
+// returns true if an identifier (or a keyword) can start with c
+static bool startsId(char c);
+
+// reports the lexical error of a token which starts at start and stopped at pch in the given state
+static noreturn void lexError(int state, const char *start, const char *pch);
+
+// reports a lexical error, knowing its line
+static noreturn void reportLexError(int line, int state, const char *start, const char *pch);
+
+// creates an empty set of tokens for the given source
+static Tokens *newTokens(const char *pch);
 
-static int line = 1;	// the current line in the input file
+// scans from tokens->pch until a token is added or the next token would start at or after end (NULL for no limit)
+static void scanToken(const char *end);
 
-// adds a token to the end of the tokens list and returns it; sets its code and line
-static Token *addTk(int code);
+// the thread which tokenizes a chunk
+static void *tokenizeChunk(void *arg);
 
-// extracts substring from begin to (end - 1)
+// adds a token to the end of the tokens array and returns its value; sets its code and offset
+static TokenVal *addTk(int code, const char *start);
+
+// returns the line of the given offset in the source
+static int offsetLine(Tokens *tokens, int offset);
+
+// adds the starts of the lines which begin after the line breaks from begin, up to the line which starts at end (NULL for the end of the source)
+static void addLineStarts(Tokens *tokens, const char *begin, const char *end);
+
+// returns true if a chunk of the source can start at offset: at the beginning of a line, but not after a newline character constant
+static bool chunkStart(const char *src, int offset);
+
+// adds the start of a line at the gap of the lines
+static void addLine(Tokens *tokens, int offset);
+
+// returns the offset of the first char of the line k
+static int lineStart(Tokens *tokens, int k);
+
+// moves the gap of the lines before the line k; the lines after it get their offsets from the end of the source
+static void moveLineGap(Tokens *tokens, int k);
+
+// moves the gap of the tokens before the token idx, in the same way
+static void moveGap(Tokens *tokens, int idx);
+
+// returns the index of the first token which starts at or after offset
+static int firstTokenAt(Tokens *tokens, int offset);
+
+// converts the digits of an INT constant in place; returns false if the value does not fit in an int
+static bool convertInt(const char *start, int *value);
+
+// converts a DOUBLE constant in place; returns false if the value is too big or too small for a double
+static bool convertDouble(const char *start, double *value);
+
+// extracts substring from begin to (end - 1) into the text arena
 static char *extract(const char *begin, const char *end);
 
-// returns a new string after parsing the escape characters from the input string
-static char *parseEscapeChars(const char *input);
+// sets the chars of a STRING token from begin to (end - 1); only the strings with escapes are copied, the others are slices
+static void setString(TokenVal *tk, const char *begin, const char *end);
 
-void showTokens(const Token *tokens, FILE *stream) {
+void showTokens(Tokens *tokens, FILE *stream) {
 	fprintf(stream, "LINE\tNAME:VALUE\n");
-	for (const Token *tk = tokens; tk != NULL; tk = tk->next) {
-		fprintf(stream, "%d\t\t%s", tk->line, getTokenName(tk->code));
-		switch (tk->code) {
+	for (int i = 0; i < tokens->n; ++i) {
+		const TokenVal *tk = tkVal(tokens, i);
+		int code = tkCode(tokens, i);
+		fprintf(stream, "%d\t\t%s", tkLine(tokens, i), getTokenName(code));
+		switch (code) {
 			case ID:
+				fprintf(stream, ":%s\n", tk->atom->text);
+				break;
 			case STRING:
-				fprintf(stream, ":%s\n", tk->text);
+				fprintf(stream, ":%.*s\n", tk->str.len, tkStr(tokens, i));
 				break;
 			case INT:
 				fprintf(stream, ":%d\n", tk->i);
@@ -51,264 +184,813 @@ void showTokens(const Token *tokens, FILE *stream) {
 	fprintf(stream, "\n");
 }
 
-void freeTokens(Token *tokens) {
-	Token *tokenIter = NULL;
-	while (tokens) {
-		tokenIter = tokens;
-		if (tokenIter->code == ID || tokenIter->code == STRING) {
-			free(tokenIter->text);
+void freeTokens(Tokens *tokens) {
+	free(tokens->codes);
+	free(tokens->offsets);
+	free(tokens->vals);
+	free(tokens->lineStarts);
+	arenaFree(&tokens->text);
+	free(tokens);
+}
+
+int tkLine(Tokens *tokens, int idx) {
+	return offsetLine(tokens, tkOffset(tokens, idx));
+}
+
+Tokens *newTokens(const char *pch) {
+	pthread_once(&tablesOnce, buildTables);
+	Tokens *tks = (Tokens*) safeAlloc(sizeof(Tokens));
+	memset(tks, 0, sizeof(Tokens));
+	arenaInit(&tks->text);
+	tks->src = pch;
+	tks->pch = pch;
+	tks->mask = ~0u;
+	tks->gap = INT_MAX;
+	return tks;
+}
+
+Tokens *tokenize(const char *pch) {
+	Tokens *tks = newTokens(pch);
+	// if the errors go back to the caller, the tokens are freed before
+	ErrTrap trap;
+	ErrTrap *saved = errTrap;
+	if (saved) {
+		errTrap = &trap;
+		if (setjmp(trap.env)) {
+			errTrap = saved;
+			freeTokens(tks);
+			errRethrow(&trap);
 		}
-		tokens = tokens->next;
-		free(tokenIter);
-	}
-}
-
-Token *tokenize(const char *pch) {
-	const char *start;
-	char *text;
-	Token *tk;
-	for (;;) {
-		switch (*pch) {
-			// delimiters
-			case ',': 	addTk(COMMA); ++pch; break;
-			case ';': 	addTk(SEMICOLON); ++pch; break;
-			case '(': 	addTk(LPAR); ++pch; break;
-			case ')': 	addTk(RPAR); ++pch; break;
-			case '[': 	addTk(LBRACKET); ++pch; break;
-			case ']': 	addTk(RBRACKET); ++pch; break;
-			case '{': 	addTk(LACC); ++pch; break;
-			case '}': 	addTk(RACC); ++pch; break;
-			case '\0':	addTk(END);	return tokens;
-
-
-			// operators
-			case '+': addTk(ADD); ++pch; break;
-			case '-': addTk(SUB); ++pch; break;
-			case '*': addTk(MUL); ++pch; break;
-			case '.': 
-				if (isalpha(pch[1]) || pch[1] == '_') {
-					addTk(DOT); 
-					++pch; 
-					break;
-				}
-				err("Invalid operator on line %d: \'%c\' (ASCII: %d)\nExpected an identifier before & after DOT operator", line, *pch, *pch);
+	}
+	while (tks->pch) {
+		nextToken(tks);
+	}
+	errTrap = saved;
+	return tks;
+}
 
-			case '/':
-				if (pch[1] == '/') { // sngle-line comment
-					// ignore characters until newline or EOF
-					for (pch += 2; *pch != '\r' && *pch != '\n' && *pch != '\0'; ++pch); 
-				} else {
-					addTk(DIV);
-					++pch;
-				}
-				break;
+Tokens *openTokenStream(const char *pch) {
+	Tokens *tks = newTokens(pch);
+	tks->cap = INITIAL_STREAM_CAP;
+	tks->mask = tks->cap - 1;
+	tks->codes = safeAlloc(tks->cap * sizeof(*tks->codes));
+	tks->offsets = safeAlloc(tks->cap * sizeof(*tks->offsets));
+	tks->vals = safeAlloc(tks->cap * sizeof(*tks->vals));
+	return tks;
+}
 
-			case '!': 
-				if (pch[1] == '=') {
-					addTk(NOTEQ);
-					pch += 2;
-				} else {
-					addTk(NOT); 
-					++pch; 
-				}
-				break;
+Tokens *tokenizeParallel(const char *pch, size_t len, int nThreads) {
+	if (nThreads <= 0) {
+		nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	int nChunks = len / MIN_CHUNK_SIZE;
+	if (nChunks > nThreads) {
+		nChunks = nThreads;
+	}
+	if (nChunks > MAX_CHUNKS) {
+		nChunks = MAX_CHUNKS;
+	}
+	if (nChunks <= 1) {
+		return tokenize(pch);
+	}
 
-			case '&':
-				if (pch[1] == '&') {
-					addTk(AND);
-					pch += 2;
-					break;
-				}
-				err("Invalid operator on line %d: \'%c\' (ASCII: %d)\nExpected a second \'%c\'", line, *pch, *pch, *pch);
+	// each chunk ends after a newline, but not after a newline which is the char of a character constant
+	Chunk chunks[MAX_CHUNKS];
+	const char *begin = pch, *srcEnd = pch + len;
+	int n = 0;
+	for (int i = 0; i < nChunks && begin < srcEnd; ++i) {
+		const char *end = srcEnd;
+		if (i < nChunks - 1) {
+			const char *p = begin + (srcEnd - begin) / (nChunks - i);
+			while ((p = memchr(p, '\n', srcEnd - p)) && p[-1] == '\'') {
+				++p;
+			}
+			end = p ? p + 1 : srcEnd;
+		}
+		Chunk *c = &chunks[n++];
+		c->tokens = newTokens(pch);
+		c->tokens->pch = begin;
+		// the last chunk must also scan END
+		c->end = end == srcEnd ? NULL : end;
+		c->errState = S_DEAD;
+		begin = end;
+	}
 
-			case '|':
-				if (pch[1] == '|') {
-					addTk(OR);
-					pch += 2;
-					break;
-				}
-				err("Invalid operator on line %d: \'%c\' (ASCII: %d)\nExpected a second \'%c\'", line, *pch, *pch, *pch);
+	// the calling thread tokenizes the first chunk
+	for (int i = 1; i < n; ++i) {
+		if (pthread_create(&chunks[i].thread, NULL, tokenizeChunk, &chunks[i])) {
+			// the threads which were created use the chunks, so they are waited for before the chunks are freed
+			for (int k = 1; k < i; ++k) {
+				pthread_join(chunks[k].thread, NULL);
+			}
+			for (int k = 0; k < n; ++k) {
+				freeTokens(chunks[k].tokens);
+			}
+			err("Cannot create a lexer thread");
+		}
+	}
+	tokenizeChunk(&chunks[0]);
+	for (int i = 1; i < n; ++i) {
+		pthread_join(chunks[i].thread, NULL);
+	}
 
-			case '=':
-				if (pch[1] == '=') {
-					addTk(EQUAL);
-					pch += 2;
-				} else {
-					addTk(ASSIGN);
-					++pch;
+	// the tokens of the chunks are joined in order; their offsets are already from the whole source
+	Tokens *tks = newTokens(pch);
+	tks->pch = NULL;
+	tks->srcLen = len;
+	for (int i = 0; i < n; ++i) {
+		tks->n += chunks[i].tokens->n;
+	}
+	tks->cap = tks->n;
+	tks->codes = safeAlloc(tks->cap * sizeof(*tks->codes));
+	tks->offsets = safeAlloc(tks->cap * sizeof(*tks->offsets));
+	tks->vals = safeAlloc(tks->cap * sizeof(*tks->vals));
+	int errChunk = -1;
+	for (int i = 0, pos = 0; i < n; ++i) {
+		Tokens *c = chunks[i].tokens;
+		memcpy(tks->codes + pos, c->codes, c->n * sizeof(*c->codes));
+		memcpy(tks->offsets + pos, c->offsets, c->n * sizeof(*c->offsets));
+		memcpy(tks->vals + pos, c->vals, c->n * sizeof(*c->vals));
+		pos += c->n;
+		arenaMerge(&tks->text, &c->text);
+		freeTokens(c);
+		if (chunks[i].errState != S_DEAD && errChunk < 0) {
+			errChunk = i;
+		}
+	}
+	if (errChunk >= 0) {
+		// if the errors go back to the caller, the tokens are freed before, like in tokenize
+		ErrTrap trap;
+		ErrTrap *saved = errTrap;
+		if (saved) {
+			errTrap = &trap;
+			if (setjmp(trap.env)) {
+				errTrap = saved;
+				freeTokens(tks);
+				errRethrow(&trap);
+			}
+		}
+		// the first error from the source, as the sequential scanning would report it
+		tokens = tks;
+		lexError(chunks[errChunk].errState, chunks[errChunk].errStart, chunks[errChunk].errPch);
+	}
+	return tks;
+}
+
+void *tokenizeChunk(void *arg) {
+	chunk = (Chunk*) arg;
+	tokens = chunk->tokens;
+	if (!setjmp(chunk->onError)) {
+		while (tokens->pch && (!chunk->end || tokens->pch < chunk->end)) {
+			scanToken(chunk->end);
+		}
+	}
+	chunk = NULL;
+	return NULL;
+}
+
+int editedLinesEnd(const char *p) {
+	// a token can continue after a newline only in a character constant
+	if (*p) {
+		for (const char *q = p + 1; (q = strchr(q, '\n')); ++q) {
+			if (q[-1] != '\'') {
+				return q + 1 - p;
+			}
+		}
+	}
+	return -1;
+}
+
+int retokenize(Tokens *tks, const char *src, const char *srcEnd, int start, int oldEnd, int newEnd, int *nRemoved, int *nAdded) {
+	int delta = newEnd - oldEnd;
+
+	// the edited lines: from the line of start to the end of the line of newEnd (NULL: to the end of the source)
+	int begin = start;
+	while (!chunkStart(src, begin)) {
+		--begin;
+	}
+	int n = editedLinesEnd(src + newEnd);
+	const char *end = n < 0 ? NULL : src + newEnd + n;
+	int endOld = end ? end - src - delta : 0;
+	int i0 = firstTokenAt(tks, begin);
+	int i1 = end ? firstTokenAt(tks, endOld) : tks->n;
+
+	// the edited lines are scanned as a chunk, so an error does not change the tokens
+	Chunk c;
+	c.tokens = newTokens(src);
+	c.tokens->pch = src + begin;
+	c.end = end;
+	c.errState = S_DEAD;
+	tokenizeChunk(&c);
+	Tokens *added = c.tokens;
+	if (c.errState != S_DEAD) {
+		freeTokens(added);
+		int line = offsetLine(tks, begin);
+		for (const char *p = src + begin; p < c.errStart; ++p) {
+			if (*p == '\n' || (*p == '\r' && p[1] != '\n')) {
+				++line;
+			}
+		}
+		tokens = tks;
+		reportLexError(line, c.errState, c.errStart, c.errPch);
+	}
+
+	// the removed tokens join the gap, which is moved after them; the tokens after it are not changed
+	moveGap(tks, i1);
+	tks->gap = i0;
+	tks->n -= i1 - i0;
+	if (tks->cap - tks->n < added->n) {
+		int nAfter = tks->n - tks->gap, cap = tks->cap;
+		tks->cap = tks->n + added->n > cap * 2 ? tks->n + added->n : cap * 2;
+		tks->codes = safeRealloc(tks->codes, tks->cap * sizeof(*tks->codes));
+		tks->offsets = safeRealloc(tks->offsets, tks->cap * sizeof(*tks->offsets));
+		tks->vals = safeRealloc(tks->vals, tks->cap * sizeof(*tks->vals));
+		memmove(tks->codes + tks->cap - nAfter, tks->codes + cap - nAfter, nAfter * sizeof(*tks->codes));
+		memmove(tks->offsets + tks->cap - nAfter, tks->offsets + cap - nAfter, nAfter * sizeof(*tks->offsets));
+		memmove(tks->vals + tks->cap - nAfter, tks->vals + cap - nAfter, nAfter * sizeof(*tks->vals));
+	}
+	// an edit which only removes tokens has no arrays to copy
+	if (added->n) {
+		memcpy(tks->codes + i0, added->codes, added->n * sizeof(*tks->codes));
+		memcpy(tks->offsets + i0, added->offsets, added->n * sizeof(*tks->offsets));
+		memcpy(tks->vals + i0, added->vals, added->n * sizeof(*tks->vals));
+	}
+	tks->gap += added->n;
+	tks->n += added->n;
+	arenaMerge(&tks->text, &added->text);
+	freeTokens(added);
+
+	// the same for the lines, which are found in the old source
+	int lineBegin = offsetLine(tks, begin) - 1;
+	int lineEnd = end ? offsetLine(tks, endOld) - 1 : tks->nLines;
+	moveLineGap(tks, lineEnd);
+	tks->nLines -= lineEnd - lineBegin - 1;
+	tks->lineGap = lineBegin + 1;
+	tks->src = src;
+	tks->srcEnd = srcEnd;
+	tks->srcLen += delta;
+	addLineStarts(tks, src + begin, end);
+
+	*nRemoved = i1 - i0;
+	*nAdded = tks->gap - i0;
+	return i0;
+}
+
+void tkRelease(Tokens *tokens, int idx) {
+	if (idx > tokens->first && tokens->mask != ~0u) {
+		tokens->first = idx < tokens->n ? idx : tokens->n;
+	}
+}
+
+int nextToken(Tokens *tks) {
+	if (!tks->pch) {
+		return tks->n - 1;
+	}
+	tokens = tks;
+	int n = tokens->n;
+	scanToken(NULL);
+	return n;
+}
+
+void scanToken(const char *end) {
+	const char *pch = tokens->pch;
+	int n = tokens->n;
+	while (tokens->n == n && (!end || pch < end)) {
+		const char *start = pch;
+		int state = S_START;
+		for (int next; (next = trans[state][charClass[(unsigned char) *pch]]) != S_DEAD; ) {
+			state = next;
+			++pch;
+			if (skipKind[state]) {
+				pch = scanSkip[skipKind[state]](pch);
+			}
+		}
+		int code = accept[state];
+		switch (code) {
+			case TK_SKIP:
+				break;
+			case TK_ERROR:
+				lexError(state, start, pch);
+			case ID:
+				addTk(ID, start)->atom = atomIntern(start, pch - start);
+				break;
+			case INT: {
+				// the constant ends at a char which cannot continue it, so it is converted in place
+				int i;
+				if (!convertInt(start, &i)) {
+					lexError(state, start, pch);
 				}
+				addTk(INT, start)->i = i;
 				break;
-
-			case '<': 
-				if (pch[1] == '=') {
-					addTk(LESSEQ);
-					pch += 2;
-				} else {
-					addTk(LESS); 
-					++pch; 
+			}
+			case DOUBLE: {
+				double d;
+				if (!convertDouble(start, &d)) {
+					lexError(state, start, pch);
 				}
+				addTk(DOUBLE, start)->d = d;
 				break;
-
-			case '>': 
-				if (pch[1] == '=') {
-					addTk(GREATEREQ);
-					pch += 2;
+			}
+			case CHAR:
+				if (start[1] == '\\') {
+					switch (start[2]) {
+						case 'n': addTk(CHAR, start)->c = '\n'; break;
+						case 'r': addTk(CHAR, start)->c = '\r'; break;
+						case 't': addTk(CHAR, start)->c = '\t'; break;
+						default: addTk(CHAR, start)->c = start[2];
+					}
 				} else {
-					addTk(GREATER); 
-					++pch; 
+					addTk(CHAR, start)->c = start[1];
+				}
+				break;
+			case STRING:
+				setString(addTk(STRING, start), start + 1, pch - 1);
+				break;
+			case DOT:
+				// DOT must be followed by an identifier
+				if (!startsId(*pch)) {
+					lexError(state, start, pch);
 				}
+				addTk(DOT, start);
 				break;
+			case END:
+				// the DFA stopped at its start: at the final '\0' or at an invalid char
+				if (*pch) {
+					lexError(state, start, pch);
+				}
+				addTk(END, start);
+				tokens->srcLen = start - tokens->src;
+				pch = NULL;
+				break;
+			default:
+				addTk(code, start);
+		}
+	}
+	tokens->pch = pch;
+}
 
+// sets the transitions from state on all the chars from chars
+static void setTrans(int state, const char *chars, int next) {
+	for (; *chars; ++chars) {
+		trans[state][charClass[(unsigned char) *chars]] = next;
+	}
+}
 
-			// whitespace
-			case '\r': if (pch[1] == '\n') ++pch;
-			case '\n': ++line;
-			case '\t':
-			case ' ': ++pch; break;
+// sets the transitions from state on all the chars except the ones from chars
+static void setTransExcept(int state, const char *chars, int next) {
+	for (int c = 0; c < numClasses; ++c) {
+		trans[state][c] = next;
+	}
+	for (; *chars; ++chars) {
+		trans[state][charClass[(unsigned char) *chars]] = S_DEAD;
+	}
+}
 
+// gives a new class to each char from chars
+static void newClasses(const char *chars) {
+	for (; *chars; ++chars) {
+		charClass[(unsigned char) *chars] = numClasses++;
+	}
+}
 
-			default:
-				if (isalpha(*pch) || *pch == '_') { // identifiers
-					for (start = pch++; isalnum(*pch) || *pch == '_'; ++pch);
-					text = extract(start, pch);
-					if (strcmp(text, "int") == 0) {
-						addTk(TYPE_INT);
-						free(text);
-					} else if (strcmp(text, "char") == 0) {
-						addTk(TYPE_CHAR);
-						free(text);
-					} else if (strcmp(text, "double") == 0) {
-						addTk(TYPE_DOUBLE);
-						free(text);
-					} else if (strcmp(text, "if") == 0) {
-						addTk(IF);
-						free(text);
-					} else if (strcmp(text, "else") == 0) {
-						addTk(ELSE);
-						free(text);
-					} else if (strcmp(text, "while") == 0) {
-						addTk(WHILE);
-						free(text);
-					} else if (strcmp(text, "void") == 0) {
-						addTk(VOID);
-						free(text);
-					} else if (strcmp(text, "return") == 0) {
-						addTk(RETURN);
-						free(text);
-					} else if (strcmp(text, "struct") == 0) {
-						addTk(STRUCT);
-						free(text);
-					} else {	// non-keyword ID
-						tk = addTk(ID);
-						tk->text = text;  
-					}
-				} else if (isdigit(*pch)) {		// numeric constant
-					for (start = pch++; isdigit(*pch); ++pch);
-					if (*pch == '.' || *pch == 'e' || *pch == 'E') {	// double 
-						int num_digits = 0;
-						if (*pch == '.') {
-							++pch;
-							for (; isdigit(*pch); ++pch, ++num_digits);	// fractional part
-							if (num_digits == 0 && tolower(*pch) != 'e') {	// no digits after '.'
-								text = extract(start, pch);
-								err("Invalid double constant on line %d: %s", line, text);
-							}
-						}
-						if (*pch == 'e' || *pch == 'E')	{
-							++pch;
-							if (*pch == '+' || *pch == '-') {
-								++pch;
-							}
-							for (num_digits = 0; isdigit(*pch); ++pch, ++num_digits);	// exponent
-							if (num_digits == 0) {	// no digits after exponent
-								text = extract(start, pch);
-								err("Invalid double constant on line %d: %s", line, text);
-							}
-						}
-						text = extract(start, pch);
-						tk = addTk(DOUBLE);
-						tk->d = atof(text);
-						free(text);
-					} else {	// integer
-						text = extract(start, pch);
-						tk = addTk(INT);
-						tk->i = atoi(text);
-						free(text);
-					}
-				} else if (*pch == '\'') {		// character constant
-					start = pch++;
-					if (*pch == '\\' && strchr(ESCAPE_CHARS, pch[1]) && pch[2] == '\'') {	// excape character
-						tk = addTk(CHAR);
-						switch (pch[1]) {
-							case 'n': tk->c = '\n'; break;
-							case 'r': tk->c = '\r'; break;
-							case 't': tk->c = '\t'; break;
-							default: tk->c = pch[1];
-						}
-						pch += 3;
-					} else if (*pch != '\\' && *pch != '\'' && pch[1] == '\'')  {	// ascii character (except \ and ')
-						tk = addTk(CHAR);
-						tk->c = *pch;
-						pch += 2;
-					} else {
-						for (; *pch != '\n' && *pch != '\r' && *pch != '\0'; ++pch);	// find newline
-						text = extract(start, pch);
-						err("Invalid character constant on line %d: %s", line, text);
-					}
-				} else if (*pch == '"') {		// string constant
-					for (start = ++pch; *pch != '"' && *pch != '\n' && *pch != '\r' && *pch != '\0'; ++pch) {
-						if (*pch == '\\' && pch[1] == '"') {	// skip escaped double quote 
-							++pch;
-						} else if (*pch == '\\' && !strchr(ESCAPE_CHARS, pch[1])) {	// invalid escape character
-							text = extract(start - 1, pch + 2);
-							err("Invalid string constant on line %d: %s\nBad escape character", line, text);
-						}
-					}
-					if (*pch == '"') {
-						tk = addTk(STRING);
-						text = extract(start, pch);
-						tk->text = parseEscapeChars(text);
-						free(text);
-						++pch;
-					} else {
-						text = extract(start - 1, pch);
-						err("Invalid string constant on line %d: %s\nMissing end double-quote", line, text);
-					}
-				} else { // error
-					err("Invalid character on line %d: \'%c\' (ASCII: %d)", line, *pch, *pch);
+// gives a single new class to all the chars from chars
+static void newClass(const char *chars) {
+	for (; *chars; ++chars) {
+		charClass[(unsigned char) *chars] = numClasses;
+	}
+	++numClasses;
+}
+
+void buildTables() {
+	// char classes: all the chars which are not named below are invalid and have the class 0
+	memset(charClass, 0, sizeof(charClass));
+	numClasses = 1;
+	// each letter used in keywords has its own class, so the keywords can be followed by the DFA
+	for (int k = 0; k < NUM_KEYWORDS; ++k) {
+		for (const char *c = KEYWORDS[k]; *c; ++c) {
+			if (!charClass[(unsigned char) *c]) {
+				charClass[(unsigned char) *c] = numClasses++;
+			}
+		}
+	}
+	newClass("E");	// exponent, like 'e'
+	for (const char *c = ID_CHARS; *c; ++c) {	// the rest of the letters
+		if (!charClass[(unsigned char) *c]) {
+			charClass[(unsigned char) *c] = numClasses;
+		}
+	}
+	++numClasses;
+	newClass(DIGITS);
+	newClasses(",;()[]{}+-*/.&|!=<>\'\"\\");
+	newClass(" \t");
+	newClass("\r\n");
+	charClass[0] = numClasses++;	// '\0'
+	if (numClasses > MAX_CLASSES) {
+		err("Too many char classes in the lexer DFA");
+	}
+
+	memset(trans, S_DEAD, sizeof(trans));
+	for (int s = 0; s < MAX_STATES; ++s) {
+		accept[s] = TK_ERROR;
+	}
+
+	// whitespace and comments
+	setTrans(S_START, " \t\r\n", S_SPACE);
+	setTrans(S_SPACE, " \t\r\n", S_SPACE);
+	accept[S_SPACE] = TK_SKIP;
+	setTrans(S_START, "/", S_SLASH);
+	accept[S_SLASH] = DIV;
+	setTrans(S_SLASH, "/", S_COMMENT);
+	setTransExcept(S_COMMENT, "\r\n", S_COMMENT);
+	trans[S_COMMENT][charClass[0]] = S_DEAD;
+	accept[S_COMMENT] = TK_SKIP;
+
+	// delimiters and single char operators
+	static const struct { const char *chars; int state; int code; } SINGLE[] = {
+		{ ",", S_COMMA, COMMA }, { ";", S_SEMICOLON, SEMICOLON }, { "(", S_LPAR, LPAR }, { ")", S_RPAR, RPAR },
+		{ "[", S_LBRACKET, LBRACKET }, { "]", S_RBRACKET, RBRACKET }, { "{", S_LACC, LACC }, { "}", S_RACC, RACC },
+		{ "+", S_ADD, ADD }, { "-", S_SUB, SUB }, { "*", S_MUL, MUL }, { ".", S_DOT, DOT },
+		{ "!", S_NOT, NOT }, { "=", S_ASSIGN, ASSIGN }, { "<", S_LESS, LESS }, { ">", S_GREATER, GREATER }
+	};
+	for (int i = 0; i < (int) (sizeof(SINGLE) / sizeof(SINGLE[0])); ++i) {
+		setTrans(S_START, SINGLE[i].chars, SINGLE[i].state);
+		accept[SINGLE[i].state] = SINGLE[i].code;
+	}
+	// the final '\0' is not consumed, so the scanner never reads past it
+	accept[S_START] = END;
+
+	// two chars operators
+	setTrans(S_START, "&", S_AMP);
+	setTrans(S_AMP, "&", S_AND);
+	accept[S_AND] = AND;
+	setTrans(S_START, "|", S_PIPE);
+	setTrans(S_PIPE, "|", S_OR);
+	accept[S_OR] = OR;
+	setTrans(S_NOT, "=", S_NOTEQ);
+	accept[S_NOTEQ] = NOTEQ;
+	setTrans(S_ASSIGN, "=", S_EQUAL);
+	accept[S_EQUAL] = EQUAL;
+	setTrans(S_LESS, "=", S_LESSEQ);
+	accept[S_LESSEQ] = LESSEQ;
+	setTrans(S_GREATER, "=", S_GREATEREQ);
+	accept[S_GREATEREQ] = GREATEREQ;
+
+	// identifiers
+	setTrans(S_START, ID_CHARS, S_ID);
+	setTrans(S_ID, ID_CHARS, S_ID);
+	setTrans(S_ID, DIGITS, S_ID);
+	accept[S_ID] = ID;
+
+	// keywords: a trie of states inside the identifiers automaton
+	numStates = S_KEYWORDS;
+	for (int k = 0; k < NUM_KEYWORDS; ++k) {
+		int s = S_START;
+		for (const char *c = KEYWORDS[k]; *c; ++c) {
+			int next = trans[s][charClass[(unsigned char) *c]];
+			if (next == S_ID) {
+				if (numStates == MAX_STATES) {
+					err("Too many states in the lexer DFA");
 				}
+				next = numStates++;
+				// any other identifier char leads to a plain identifier
+				setTrans(next, ID_CHARS, S_ID);
+				setTrans(next, DIGITS, S_ID);
+				accept[next] = ID;
+				trans[s][charClass[(unsigned char) *c]] = next;
+			}
+			s = next;
 		}
+		accept[s] = KEYWORD_CODES[k];
+	}
+
+	// numeric constants
+	setTrans(S_START, DIGITS, S_INT);
+	setTrans(S_INT, DIGITS, S_INT);
+	accept[S_INT] = INT;
+	setTrans(S_INT, ".", S_FRAC0);
+	setTrans(S_INT, "eE", S_EXP0);
+	setTrans(S_FRAC0, DIGITS, S_FRAC);
+	setTrans(S_FRAC0, "eE", S_EXP0);
+	setTrans(S_FRAC, DIGITS, S_FRAC);
+	setTrans(S_FRAC, "eE", S_EXP0);
+	accept[S_FRAC] = DOUBLE;
+	setTrans(S_EXP0, "+-", S_EXPSIGN);
+	setTrans(S_EXP0, DIGITS, S_EXP);
+	setTrans(S_EXPSIGN, DIGITS, S_EXP);
+	setTrans(S_EXP, DIGITS, S_EXP);
+	accept[S_EXP] = DOUBLE;
+
+	// character constants
+	setTrans(S_START, "\'", S_CHAR0);
+	setTransExcept(S_CHAR0, "\\\'", S_CHAR1);
+	trans[S_CHAR0][charClass[0]] = S_DEAD;
+	setTrans(S_CHAR0, "\\", S_CHAR_ESC);
+	setTrans(S_CHAR_ESC, ESCAPE_CHARS, S_CHAR1);
+	setTrans(S_CHAR1, "\'", S_CHAR_END);
+	accept[S_CHAR_END] = CHAR;
+
+	// string constants
+	setTrans(S_START, "\"", S_STR);
+	setTransExcept(S_STR, "\"\\\r\n", S_STR);
+	trans[S_STR][charClass[0]] = S_DEAD;
+	setTrans(S_STR, "\\", S_STR_ESC);
+	setTrans(S_STR_ESC, ESCAPE_CHARS, S_STR);
+	setTrans(S_STR, "\"", S_STR_END);
+	accept[S_STR_END] = STRING;
+
+	// the runs of chars on which a state loops on itself
+	memset(skipKind, SKIP_NONE, sizeof(skipKind));
+	skipKind[S_SPACE] = SKIP_BLANKS;
+	skipKind[S_COMMENT] = SKIP_COMMENT;
+	skipKind[S_ID] = SKIP_ID;
+	skipKind[S_INT] = SKIP_DIGITS;
+	skipKind[S_FRAC] = SKIP_DIGITS;
+	skipKind[S_EXP] = SKIP_DIGITS;
+	skipKind[S_STR] = SKIP_STRING;
+	scanInit();
+}
+
+bool startsId(char c) {
+	int s = trans[S_START][charClass[(unsigned char) c]];
+	return s == S_ID || s >= S_KEYWORDS;
+}
+
+void lexError(int state, const char *start, const char *pch) {
+	if (chunk) {
+		// the error is reported after all the chunks are scanned, only if no previous chunk has an error
+		chunk->errState = state;
+		chunk->errStart = start;
+		chunk->errPch = pch;
+		longjmp(chunk->onError, 1);
 	}
+	reportLexError(offsetLine(tokens, start - tokens->src), state, start, pch);
 }
 
-Token *addTk(int code) {
-	Token *tk = safeAlloc(sizeof(Token));
-	tk->code = code;
-	tk->line = line;
-	tk->next = NULL;
-	if (lastTk != NULL) {
-		lastTk->next = tk;
-	} else {
-		tokens = tk;
+void reportLexError(int line, int state, const char *start, const char *pch) {
+	switch (state) {
+		case S_START:
+			errLine(line, "Invalid character on line %d: \'%c\' (ASCII: %d)", line, *pch, *pch);
+		case S_DOT:
+			errLine(line, "Invalid operator on line %d: \'%c\' (ASCII: %d)\nExpected an identifier before & after DOT operator", line, *start, *start);
+		case S_AMP:
+		case S_PIPE:
+			errLine(line, "Invalid operator on line %d: \'%c\' (ASCII: %d)\nExpected a second \'%c\'", line, *start, *start, *start);
+		case S_INT:
+			errLine(line, "Invalid int constant on line %d: %s\nThe value is too big for an int", line, extract(start, pch));
+		case S_FRAC:
+		case S_EXP:
+			errLine(line, "Invalid double constant on line %d: %s\nThe value is out of the range of a double", line, extract(start, pch));
+		case S_FRAC0:
+		case S_EXP0:
+		case S_EXPSIGN:
+			errLine(line, "Invalid double constant on line %d: %s", line, extract(start, pch));
+		case S_CHAR0:
+		case S_CHAR_ESC:
+		case S_CHAR1:
+			for (; *pch != '\n' && *pch != '\r' && *pch != '\0'; ++pch);	// find newline
+			errLine(line, "Invalid character constant on line %d: %s", line, extract(start, pch));
+		case S_STR_ESC:
+			if (*pch != '\0') {
+				errLine(line, "Invalid string constant on line %d: %s\nBad escape character", line, extract(start, pch + 1));
+			}
+		default:	// S_STR
+			errLine(line, "Invalid string constant on line %d: %s\nMissing end double-quote", line, extract(start, pch));
 	}
-	lastTk = tk;
-	return tk;
 }
 
-char *extract(const char *begin, const char *end) {
-	int n = end - begin;
-	char *substr = safeAlloc(n + 1);
-	for (int i = 0; i < n; ++i) {
-		substr[i] = begin[i];
+// doubles the capacity of the tokens arrays
+static void growTokens() {
+	if (tokens->mask == ~0u) {
+		tokens->cap = tokens->cap ? tokens->cap * 2 : INITIAL_TOKENS_CAP;
+		tokens->codes = safeRealloc(tokens->codes, tokens->cap * sizeof(*tokens->codes));
+		tokens->offsets = safeRealloc(tokens->offsets, tokens->cap * sizeof(*tokens->offsets));
+		tokens->vals = safeRealloc(tokens->vals, tokens->cap * sizeof(*tokens->vals));
+		return;
 	}
-	substr[n] = '\0';
-	return substr;
+	// a ring: the kept tokens are moved to their positions in the new ring
+	int cap = tokens->cap * 2;
+	unsigned mask = cap - 1;
+	unsigned char *codes = safeAlloc(cap * sizeof(*codes));
+	int *offsets = safeAlloc(cap * sizeof(*offsets));
+	TokenVal *vals = safeAlloc(cap * sizeof(*vals));
+	for (int i = tokens->first; i < tokens->n; ++i) {
+		codes[i & mask] = tokens->codes[i & tokens->mask];
+		offsets[i & mask] = tokens->offsets[i & tokens->mask];
+		vals[i & mask] = tokens->vals[i & tokens->mask];
+	}
+	free(tokens->codes);
+	free(tokens->offsets);
+	free(tokens->vals);
+	tokens->codes = codes;
+	tokens->offsets = offsets;
+	tokens->vals = vals;
+	tokens->cap = cap;
+	tokens->mask = mask;
+}
+
+TokenVal *addTk(int code, const char *start) {
+	if (tokens->n - tokens->first == tokens->cap) {
+		growTokens();
+	}
+	int i = tokens->n++ & tokens->mask;
+	tokens->codes[i] = code;
+	tokens->offsets[i] = start - tokens->src;
+	return &tokens->vals[i];
 }
 
-static char *parseEscapeChars(const char *input) {
-	char *s = safeAlloc(strlen(input) + 1);
+int offsetLine(Tokens *tokens, int offset) {
+	if (!tokens->lineStarts) {
+		tokens->capLines = 256;
+		tokens->lineStarts = safeAlloc(tokens->capLines * sizeof(int));
+		tokens->lineStarts[0] = 0;
+		tokens->nLines = 1;
+		tokens->lineGap = 1;
+		addLineStarts(tokens, tokens->src, NULL);
+	}
+	// binary search for the last line which starts at or before offset
+	int left = 0, right = tokens->nLines - 1;
+	while (left < right) {
+		int mid = (left + right + 1) / 2;
+		if (lineStart(tokens, mid) <= offset) {
+			left = mid;
+		} else {
+			right = mid - 1;
+		}
+	}
+	return left + 1;
+}
+
+bool convertInt(const char *start, int *value) {
+	int i = 0;
+	for (const char *p = start; *p >= '0' && *p <= '9'; ++p) {
+		int digit = *p - '0';
+		if (i > (INT_MAX - digit) / 10) {
+			return false;
+		}
+		i = i * 10 + digit;
+	}
+	*value = i;
+	return true;
+}
+
+// the powers of 10 which are exact doubles
+static const double EXACT_POW10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+#define MAX_EXACT_POW10 22
+#define MAX_EXACT_MANTISSA (1ull << 53)
+#define MAX_MANTISSA_DIGITS 19	// the most decimal digits which always fit in 64 bits
+
+bool convertDouble(const char *start, double *value) {
+	// the decimal digits as mantissa * 10^exp10
+	uint64_t mantissa = 0;
+	int nDigits = 0, exp10 = 0;
+	bool truncated = false;
+	const char *p = start;
+	for (bool frac = false; ; ++p) {
+		if (*p == '.') {
+			frac = true;
+			continue;
+		}
+		if (*p < '0' || *p > '9') {
+			break;
+		}
+		if (nDigits < MAX_MANTISSA_DIGITS) {
+			mantissa = mantissa * 10 + (*p - '0');
+			nDigits += mantissa != 0;	// the leading zeros do not count
+			exp10 -= frac;
+		} else {
+			truncated |= *p != '0';
+			exp10 += !frac;
+		}
+	}
+	if (*p == 'e' || *p == 'E') {
+		++p;
+		int sign = *p == '-' ? -1 : 1;
+		if (*p == '-' || *p == '+') {
+			++p;
+		}
+		int e = 0;
+		for (; *p >= '0' && *p <= '9'; ++p) {
+			if (e < 100000) {	// far beyond the range of a double, but it cannot overflow
+				e = e * 10 + (*p - '0');
+			}
+		}
+		exp10 += sign * e;
+	}
+	if (mantissa == 0 && !truncated) {
+		*value = 0;
+		return true;
+	}
+
+	// Clinger's fast path: the mantissa and the power of 10 are exact doubles, so a single
+	// multiplication or division is correctly rounded
+	if (!truncated && mantissa <= MAX_EXACT_MANTISSA && exp10 >= -MAX_EXACT_POW10 && exp10 <= MAX_EXACT_POW10) {
+		double d = (double) mantissa;
+		*value = exp10 < 0 ? d / EXACT_POW10[-exp10] : d * EXACT_POW10[exp10];
+		return true;
+	}
+
+	// the exact conversion, also directly from the source: strtod stops where the constant ends
+	*value = strtod(start, NULL);
+	return !isinf(*value) && *value != 0;
+}
+
+void addLineStarts(Tokens *tokens, const char *begin, const char *end) {
+	// a line ends with "\r\n", "\r" or "\n"
+	for (const char *p = begin; *p && (!end || p < end); ++p) {
+		if (*p == '\n' || *p == '\r') {
+			if (*p == '\r' && p[1] == '\n') {
+				++p;
+			}
+			if (end && p + 1 >= end) {
+				break;
+			}
+			addLine(tokens, p + 1 - tokens->src);
+		}
+	}
+}
+
+void addLine(Tokens *tokens, int offset) {
+	if (tokens->nLines == tokens->capLines) {
+		int nAfter = tokens->nLines - tokens->lineGap;
+		tokens->capLines *= 2;
+		tokens->lineStarts = safeRealloc(tokens->lineStarts, tokens->capLines * sizeof(int));
+		memmove(tokens->lineStarts + tokens->capLines - nAfter, tokens->lineStarts + tokens->lineGap, nAfter * sizeof(int));
+	}
+	tokens->lineStarts[tokens->lineGap++] = offset;
+	tokens->nLines++;
+}
+
+int lineStart(Tokens *tokens, int k) {
+	if (k < tokens->lineGap) {
+		return tokens->lineStarts[k];
+	}
+	return tokens->lineStarts[k + tokens->capLines - tokens->nLines] + tokens->srcLen;
+}
+
+void moveLineGap(Tokens *tokens, int k) {
+	int *lines = tokens->lineStarts, nFree = tokens->capLines - tokens->nLines;
+	while (tokens->lineGap > k) {
+		int i = --tokens->lineGap;
+		lines[i + nFree] = lines[i] - tokens->srcLen;
+	}
+	for (; tokens->lineGap < k; ++tokens->lineGap) {
+		int i = tokens->lineGap;
+		lines[i] = lines[i + nFree] + tokens->srcLen;
+	}
+}
+
+void moveGap(Tokens *tokens, int idx) {
+	if (tokens->gap == INT_MAX) {
+		tokens->gap = tokens->n;
+	}
+	int nFree = tokens->cap - tokens->n;
+	while (tokens->gap > idx) {
+		int i = --tokens->gap;
+		tokens->codes[i + nFree] = tokens->codes[i];
+		tokens->offsets[i + nFree] = tokens->offsets[i] - tokens->srcLen;
+		tokens->vals[i + nFree] = tokens->vals[i];
+	}
+	for (; tokens->gap < idx; ++tokens->gap) {
+		int i = tokens->gap;
+		tokens->codes[i] = tokens->codes[i + nFree];
+		tokens->offsets[i] = tokens->offsets[i + nFree] + tokens->srcLen;
+		tokens->vals[i] = tokens->vals[i + nFree];
+	}
+}
+
+bool chunkStart(const char *src, int offset) {
+	return offset == 0 || (src[offset - 1] == '\n' && (offset < 2 || src[offset - 2] != '\''));
+}
+
+int firstTokenAt(Tokens *tokens, int offset) {
+	int left = 0, right = tokens->n;
+	while (left < right) {
+		int mid = (left + right) / 2;
+		if (tkOffset(tokens, mid) < offset) {
+			left = mid + 1;
+		} else {
+			right = mid;
+		}
+	}
+	return left;
+}
+
+char *extract(const char *begin, const char *end) {
+	return arenaStrndup(&tokens->text, begin, end - begin);
+}
+
+void setString(TokenVal *tk, const char *begin, const char *end) {
+	if (!memchr(begin, '\\', end - begin)) {
+		tk->str.chars = NULL;
+		tk->str.len = end - begin;
+		return;
+	}
+	char *s = arenaAlloc(&tokens->text, end - begin + 1);
 	int n = 0;
-	for (; *input != '\0'; ++input) {
+	for (const char *input = begin; input < end; ++input) {
 		if (*input == '\\') {
 			switch (input[1]) {
 				case 'n': s[n++] = '\n'; break;
@@ -322,5 +1004,6 @@ static char *parseEscapeChars(const char *input) {
 		s[n++] = *input;
 	}
 	s[n] = '\0';
-	return s;
-}
\ No newline at end of file
+	tk->str.chars = s;
+	tk->str.len = n;
+}
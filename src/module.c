@@ -0,0 +1,289 @@
+#include "module.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+// the parts of an interface while it is written
+typedef struct
+{
+	ModuleSymbol *symbols;
+	int nSymbols;
+	int capSymbols;
+	ModuleSymbol *members;
+	int nMembers;
+	int capMembers;
+	char *text;
+	int textSize;
+	int capText;
+} Writer;
+
+// the parts of an interface while it is read
+typedef struct
+{
+	const ModuleSymbol *symbols;
+	const ModuleSymbol *members;
+	const char *text;
+	uint32_t textSize;
+	Domain *d;
+} Reader;
+
+// adds the chars and a '\0' to the text and returns their offset
+static uint32_t addText(Writer *w, const char *chars, int len);
+static ModuleSymbol *addRecord(ModuleSymbol **list, int *n, int *cap);
+// the record of the symbol s, with its members or parameters
+static void writeSymbol(Writer *w, Symbol *s, int kind, ModuleFn *body);
+static void writeType(Writer *w, ModuleSymbol *r, TypeId type);
+static int byFn(const void *a, const void *b);
+
+// verifies all the offsets and the indexes, so the next steps can use them
+static void checkInterface(const void *data, size_t size, Reader *r);
+static const char *readName(Reader *r, uint32_t offset);
+static TypeId readType(Reader *r, const ModuleSymbol *rec);
+// the extern function must be in the domain with the signature from the record
+static void bindExtern(Reader *r, const ModuleSymbol *rec);
+static bool sameSignature(Reader *r, const ModuleSymbol *rec, Symbol *fn);
+
+bool writeInterface(FILE *out, Symbol *all, Symbol *from, ModuleFn *fns, int nFns) {
+	Writer w;
+	memset(&w, 0, sizeof(w));
+	ModuleFn *sorted = (ModuleFn*) safeAlloc((nFns ? nFns : 1) * sizeof(ModuleFn));
+	memcpy(sorted, fns, nFns * sizeof(ModuleFn));
+	qsort(sorted, nFns, sizeof(ModuleFn), byFn);
+	bool ok = true, own = false;
+	for (Symbol *s = all; s && ok; s = s->next) {
+		own = own || s == from;
+		if (s->kind == SK_FN && s->fn.extFnPtr) {
+			writeSymbol(&w, s, MODULE_EXTERN, NULL);
+		} else if (own) {
+			ModuleFn key = { s };
+			ModuleFn *body = s->kind == SK_FN ? bsearch(&key, sorted, nFns, sizeof(ModuleFn), byFn) : NULL;
+			// a function without a body cannot be used by the programs which import it
+			ok = s->kind != SK_FN || body;
+			if (ok) {
+				writeSymbol(&w, s, s->kind, body);
+			}
+		}
+	}
+	if (ok) {
+		ModuleHeader h = { MODULE_MAGIC, w.nSymbols, w.nMembers, w.textSize };
+		ok = fwrite(&h, sizeof(h), 1, out) == 1
+			&& fwrite(w.symbols, sizeof(ModuleSymbol), w.nSymbols, out) == (size_t) w.nSymbols
+			&& fwrite(w.members, sizeof(ModuleSymbol), w.nMembers, out) == (size_t) w.nMembers
+			&& fwrite(w.text, 1, w.textSize, out) == (size_t) w.textSize;
+	}
+	free(sorted);
+	free(w.symbols);
+	free(w.members);
+	free(w.text);
+	return ok;
+}
+
+int readInterface(const void *data, size_t size, Domain *d, ModuleFn **fns) {
+	Reader r;
+	r.d = d;
+	checkInterface(data, size, &r);
+	const ModuleHeader *h = (const ModuleHeader*) data;
+	ModuleFn *list = NULL;
+	int n = 0;
+	// the functions are freed if the symbols cannot be added
+	ErrTrap trap;
+	ErrTrap *saved = errTrap;
+	errTrap = &trap;
+	if (setjmp(trap.env)) {
+		errTrap = saved;
+		free(list);
+		errRethrow(&trap);
+	}
+	for (uint32_t i = 0; i < h->nSymbols; ++i) {
+		const ModuleSymbol *rec = &r.symbols[i];
+		if (rec->kind == MODULE_EXTERN) {
+			bindExtern(&r, rec);
+			continue;
+		}
+		const char *name = readName(&r, rec->name);
+		if (findSymbolInDomain(d, atomGet(name))) {
+			err("Symbol redefinition: %s", name);
+		}
+		Symbol *s = newSymbol(atomGet(name), (SymKind) rec->kind);
+		addSymbolToDomain(d, s);
+		switch (s->kind) {
+			case SK_STRUCT:
+				s->type = typeIntern(TB_STRUCT, s, -1);
+				for (uint32_t k = 0; k < rec->count; ++k) {
+					const ModuleSymbol *mr = &r.members[rec->first + k];
+					TypeId t = readType(&r, mr);
+					Symbol *m = newMember(s, atomGet(readName(&r, mr->name)), SK_VAR);
+					m->type = t;
+					// the symbol is added before it is checked, so it is freed with the domain after an error
+					addStructMember(s, m);
+					if (typeOf(m->type)->s == s) {
+						err("The struct %s cannot contain itself", name);
+					}
+					// the layout of the struct must be the same in the compiler which imports it
+					if (m->varIdx != mr->idx) {
+						err("The layout of the struct %s is not the same as in its module", name);
+					}
+				}
+				break;
+			case SK_VAR:
+				s->type = readType(&r, rec);
+				addGlobalVar(d, s);
+				break;
+			default:	// SK_FN
+				s->type = readType(&r, rec);
+				for (uint32_t k = 0; k < rec->count; ++k) {
+					const ModuleSymbol *pr = &r.members[rec->first + k];
+					Symbol *p = newMember(s, atomGet(readName(&r, pr->name)), SK_PARAM);
+					addParam(s, p);
+					p->type = readType(&r, pr);
+				}
+				if (n % 16 == 0) {
+					list = safeRealloc(list, (n + 16) * sizeof(ModuleFn));
+				}
+				list[n++] = (ModuleFn) { s, r.text + rec->body, (int) rec->len, rec->line };
+				break;
+		}
+	}
+	errTrap = saved;
+	*fns = list;
+	return n;
+}
+
+uint32_t addText(Writer *w, const char *chars, int len) {
+	if (w->textSize + len + 1 > w->capText) {
+		w->capText = (w->textSize + len + 1) * 2;
+		w->text = safeRealloc(w->text, w->capText);
+	}
+	uint32_t offset = w->textSize;
+	memcpy(w->text + offset, chars, len);
+	w->text[offset + len] = '\0';
+	w->textSize += len + 1;
+	return offset;
+}
+
+ModuleSymbol *addRecord(ModuleSymbol **list, int *n, int *cap) {
+	if (*n == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		*list = safeRealloc(*list, *cap * sizeof(ModuleSymbol));
+	}
+	ModuleSymbol *r = &(*list)[(*n)++];
+	memset(r, 0, sizeof(ModuleSymbol));
+	return r;
+}
+
+void writeSymbol(Writer *w, Symbol *s, int kind, ModuleFn *body) {
+	Symbol **members = s->kind == SK_STRUCT ? s->structMembers : s->kind == SK_FN ? s->fn.params : NULL;
+	int n = s->kind == SK_STRUCT ? s->nMembers : s->kind == SK_FN ? s->fn.nParams : 0;
+	uint32_t first = w->nMembers, count = (uint32_t) n;
+	for (int i = 0; i < n; ++i) {
+		Symbol *m = members[i];
+		ModuleSymbol *mr = addRecord(&w->members, &w->nMembers, &w->capMembers);
+		mr->name = addText(w, m->name->text, (int) strlen(m->name->text));
+		mr->kind = m->kind;
+		mr->idx = m->kind == SK_PARAM ? m->paramIdx : m->varIdx;
+		writeType(w, mr, m->type);
+	}
+	// the members are added before the symbol, so its record does not move while they are added
+	ModuleSymbol *r = addRecord(&w->symbols, &w->nSymbols, &w->capSymbols);
+	r->name = addText(w, s->name->text, (int) strlen(s->name->text));
+	r->kind = kind;
+	r->first = first;
+	r->count = count;
+	if (s->kind != SK_STRUCT) {
+		writeType(w, r, s->type);
+	}
+	if (body) {
+		r->body = addText(w, body->body, body->len);
+		r->len = body->len;
+		r->line = body->line;
+	}
+}
+
+void writeType(Writer *w, ModuleSymbol *r, TypeId type) {
+	const Type *t = typeOf(type);
+	r->tb = t->tb;
+	r->n = t->n;
+	if (t->tb == TB_STRUCT) {
+		r->typeName = addText(w, t->s->name->text, (int) strlen(t->s->name->text));
+	}
+}
+
+int byFn(const void *a, const void *b) {
+	const Symbol *fa = ((const ModuleFn*) a)->fn, *fb = ((const ModuleFn*) b)->fn;
+	return fa < fb ? -1 : fa > fb;
+}
+
+void checkInterface(const void *data, size_t size, Reader *r) {
+	const ModuleHeader *h = (const ModuleHeader*) data;
+	if (size < sizeof(ModuleHeader) || h->magic != MODULE_MAGIC) {
+		err("The file is not a module interface");
+	}
+	uint64_t records = (uint64_t) h->nSymbols + h->nMembers;
+	if (records > size / sizeof(ModuleSymbol)
+			|| sizeof(ModuleHeader) + records * sizeof(ModuleSymbol) + h->textSize != size
+			|| (h->textSize && ((const char*) data)[size - 1] != '\0')) {
+		err("The module interface is damaged");
+	}
+	r->symbols = (const ModuleSymbol*) (h + 1);
+	r->members = r->symbols + h->nSymbols;
+	r->text = (const char*) (r->members + h->nMembers);
+	r->textSize = h->textSize;
+	for (uint64_t i = 0; i < records; ++i) {
+		const ModuleSymbol *rec = &r->symbols[i];
+		bool isMember = i >= h->nSymbols;
+		bool kindOk = isMember ? rec->kind == SK_VAR || rec->kind == SK_PARAM
+			: rec->kind == SK_STRUCT || rec->kind == SK_VAR || rec->kind == SK_FN || rec->kind == MODULE_EXTERN;
+		bool hasMembers = !isMember && (rec->kind == SK_STRUCT || rec->kind == SK_FN || rec->kind == MODULE_EXTERN);
+		if (!kindOk || rec->tb > TB_STRUCT || rec->name >= h->textSize || rec->typeName >= h->textSize
+				|| (hasMembers ? (uint64_t) rec->first + rec->count > h->nMembers : rec->count != 0)
+				|| (uint64_t) rec->body + rec->len >= (h->textSize ? h->textSize : 1)) {
+			err("The module interface is damaged");
+		}
+	}
+}
+
+const char *readName(Reader *r, uint32_t offset) {
+	// the text ends with '\0', so any offset in it is a string
+	return r->text + offset;
+}
+
+TypeId readType(Reader *r, const ModuleSymbol *rec) {
+	Symbol *s = NULL;
+	if (rec->tb == TB_STRUCT) {
+		const char *name = readName(r, rec->typeName);
+		s = findSymbolInDomain(r->d, atomGet(name));
+		if (!s || s->kind != SK_STRUCT) {
+			err("The struct %s from the module interface is not defined", name);
+		}
+	}
+	return typeIntern((TypeBase) rec->tb, s, rec->n);
+}
+
+void bindExtern(Reader *r, const ModuleSymbol *rec) {
+	const char *name = readName(r, rec->name);
+	Symbol *fn = findSymbolInDomain(r->d, atomGet(name));
+	if (!fn || fn->kind != SK_FN || !fn->fn.extFnPtr) {
+		err("The extern function %s needed by the module is not provided", name);
+	}
+	if (!sameSignature(r, rec, fn)) {
+		err("The extern function %s does not have the signature needed by the module", name);
+	}
+}
+
+bool sameSignature(Reader *r, const ModuleSymbol *rec, Symbol *fn) {
+	// the types are interned, so the same types have the same ids
+	if (readType(r, rec) != fn->type) {
+		return false;
+	}
+	if (rec->count != (uint32_t) fn->fn.nParams) {
+		return false;
+	}
+	for (uint32_t k = 0; k < rec->count; ++k) {
+		if (readType(r, &r->members[rec->first + k]) != fn->fn.params[k]->type) {
+			return false;
+		}
+	}
+	return true;
+}
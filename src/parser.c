@@ -7,14 +7,61 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdbool.h>
-
-static Token *iTk;				// the iterator in the tokens list
-static Token *consumedTk;		// the last consumed token
-static Symbol *owner = NULL;	// the symbol we are inside of at a given time
+#include <string.h>
+#include <limits.h>
+
+// the state of the parser, for each thread
+static _Thread_local Tokens *tokens;			// the tokens being parsed
+static _Thread_local int iTk;					// the index of the current token
+static _Thread_local int consumedTk;			// the index of the last consumed token
+static _Thread_local Symbol *owner = NULL;		// the symbol we are inside of at a given time
+static _Thread_local Ast *ast;					// the tree being built
+// if not NULL, fnDef skips the body of the function and saves it here (parseDeclaration)
+static _Thread_local Declaration *decl;
+
+/*
+	the stack of the positions where the parser can go back
+	the tokens before the oldest position are not needed anymore and they are released
+*/
+static _Thread_local int *marks;
+static _Thread_local int nMarks;
+static _Thread_local int capMarks;
 
 static void tkerr(const char *fmt, ...);
 static bool consume(int code);
 
+// saves the current position, so the parser can go back to it
+static void mark();
+// goes back to the last saved position and forgets it
+static void backtrack();
+// forgets the last saved position without going back to it
+static void commit();
+
+// the node with the given index; the pointer is valid only until the next node is added
+#define NODE(id) astNode(ast, id)
+
+// the line of the last consumed token
+static int consumedLine();
+// sets the node of r to a new expression node with the type from r and the children a and b
+static void exprNode(NodeKind kind, int line, Ret *r, NodeId a, NodeId b);
+// makes r a constant of its type, with the value val and a node for it
+static void constNode(Ret *r, int line, ConstVal val);
+/*
+	compute at compile time the operation with known operands, with the same result as the VM
+	return false if an operand is not known or if the operation must be done at run time
+*/
+static bool foldBinary(int op, Ret *a, Ret *b, TypeId t, ConstVal *val);
+static bool foldUnary(NodeKind kind, Ret *a, TypeId t, ConstVal *val);
+// the value of a known int or char, as it is in a VM cell
+static int knownInt(Ret *r);
+static bool knownTruth(Ret *r);
+// adds the node id at the end of the list from first to last
+static void appendNode(NodeId *first, NodeId *last, NodeId id);
+// adds the function fn with the given body to the tree and returns its node
+static NodeId fnNode(Symbol *fn, int line, NodeId body);
+// returns the index of the token after the "{...}" which starts at the token idx
+static int skipBody(int idx);
+
 static bool unit();
 static bool structDef();
 static bool varDef();
@@ -22,55 +69,383 @@ static bool typeBase(Type *t);
 static bool arrayDecl(Type *t);
 static bool fnDef();
 static bool fnParam();
-static bool stm();
-static bool stmCompound(bool newDomain);
+static bool stm(NodeId *node);
+static bool stmCompound(bool newDomain, NodeId *node);
 static bool expr(Ret *r);
 static bool exprAssign(Ret *r);
-static bool exprOr(Ret *r);
-static bool _exprOr(Ret *r);
-static bool exprAnd(Ret *r);
-static bool _exprAnd(Ret *r);
-static bool exprEq(Ret *r);
-static bool _exprEq(Ret *r);
-static bool exprRel(Ret *r);
-static bool _exprRel(Ret *r);
-static bool exprAdd(Ret *r);
-static bool _exprAdd(Ret *r);
-static bool exprMul(Ret *r);
-static bool _exprMul(Ret *r);
+// continues the expression which starts with the operand r with the binary operators of at least the level minPrec
+static void exprBinary(Ret *r, int minPrec);
+// true if the current "(" starts a cast
+static bool castFollows();
 static bool exprCast(Ret *r);
 static bool exprUnary(Ret *r);
 static bool exprPostfix(Ret *r);
 static bool _exprPostfix(Ret *r);
 static bool exprPrimary(Ret *r);
 
-void parse(Token *tokens) {
-	iTk = tokens;
+/*
+	the binary operators, by token code, from the weakest level (1) to the strongest
+	all of them are left associative
+*/
+typedef struct
+{
+	int prec;				// the level, 0 if the token is not a binary operator
+	bool arith;				// true if the result has the type of the arithmetic operation, else it is int
+	const char *typeErr;	// the error for invalid operand types
+	const char *missingErr;	// the error for a missing right operand
+} BinOp;
+
+static const BinOp binOps[GREATEREQ + 1] = {
+	[OR] = { 1, false, "Invalid operand type for \"||\" (LOGICAL OR)", "Invalid/missing expression after \"||\" (LOGICAL OR) operator" },
+	[AND] = { 2, false, "Invalid operand type for \"&&\" (LOGICAL AND)", "Invalid/missing expression after \"&&\" (LOGICAL AND) operator" },
+	[EQUAL] = { 3, false, "Invalid operand type for \"==\" (EQUAL)", "Invalid/missing expression after \"==\" (EQUAL) operator" },
+	[NOTEQ] = { 3, false, "Invalid operand type for \"!=\" (NOT EQUAL)", "Invalid/missing expression after \"!=\" (NOT EQUAL) operator" },
+	[LESS] = { 4, false, "invalid operand type for \"<\" (LESS)", "Invalid/missing expression after \"<\" (LESS) operator" },
+	[LESSEQ] = { 4, false, "invalid operand type for \"<=\" (LESS OR EQUAL)", "Invalid/missing expression after \"<=\" (LESS OR EQUAL) operator" },
+	[GREATER] = { 4, false, "invalid operand type for \">\" (GREATER)", "Invalid/missing expression after \">\" (GREATER) operator" },
+	[GREATEREQ] = { 4, false, "invalid operand type for \">=\" (GREATER OR EQUAL)", "Invalid/missing expression after \">=\" (GREATER OR EQUAL) operator" },
+	[ADD] = { 5, true, "Invalid operand type for \"+\" (ADDITION) ", "Invalid/missing expression after \"+\" (ADDITION) operator" },
+	[SUB] = { 5, true, "Invalid operand type for \"-\" (SUBTRACTION)", "Invalid/missing expression after \"-\" (SUBTRACTION) operator" },
+	[MUL] = { 6, true, "Invalid operand type for \"*\" (MULTIPLICATION)", "Invalid/missing expression after \"*\" (MULTIPLICATION) operator" },
+	[DIV] = { 6, true, "Invalid operand type for \"/\" (DIVISION)", "Invalid/missing expression after \"/\" (DIVISION) operator" },
+};
+
+// the value of the token with the given index
+#define TK(idx) (*tkVal(tokens, idx))
+
+void parse(Tokens *tks, Ast *tree) {
+	tokens = tks;
+	ast = tree;
+	iTk = 0;
 	if (!unit()) {
 		tkerr("Syntax error");
 	}
+	parseEnd();
 	printf("Syntax ok\n");
 }
 
+int parseTopLevel(Tokens *tks, int idx, Ast *tree) {
+	tokens = tks;
+	ast = tree;
+	iTk = idx;
+	nMarks = 0;		// an error could have left some marks
+	owner = NULL;
+	decl = NULL;
+	if (tkCode(tokens, iTk) == END) {
+		return iTk;
+	}
+	if (structDef() || fnDef() || varDef()) {
+		return iTk;
+	}
+	tkerr("Syntax error");
+	return iTk;
+}
+
+int parseDeclaration(Tokens *tks, int idx, Declaration *d) {
+	tokens = tks;
+	ast = NULL;
+	iTk = idx;
+	nMarks = 0;
+	owner = NULL;
+	decl = d;
+	d->fn = NULL;
+	if (tkCode(tokens, iTk) == END) {
+		return iTk;
+	}
+	if (structDef() || fnDef() || varDef()) {
+		decl = NULL;
+		return iTk;
+	}
+	tkerr("Syntax error");
+	return iTk;
+}
+
+NodeId parseFnBody(Tokens *tks, Declaration *d, Ast *tree) {
+	tokens = tks;
+	ast = tree;
+	iTk = d->bodyTk;
+	nMarks = 0;
+	decl = NULL;
+	owner = d->fn;
+	pushDomain();
+	// the parameters are visible in the body
+	for (int i = 0; i < d->fn->fn.nParams; ++i) {
+		addSymbolToDomain(symTable, d->fn->fn.params[i]);
+	}
+	NodeId body;
+	stmCompound(false, &body);
+	dropDomain();
+	owner = NULL;
+	return fnNode(d->fn, d->line, body);
+}
+
+int skipTopLevel(Tokens *tokens, int idx) {
+	// the end depends only on the tokens, so it does not depend on what was parsed before
+	int depth = 0;
+	for (int i = idx; ; ++i) {
+		switch (tkCode(tokens, i)) {
+			case END:
+				return i;
+			case SEMICOLON:
+				if (!depth) {
+					return i + 1;
+				}
+				break;
+			case LACC:
+				++depth;
+				break;
+			case RACC:
+				if (depth <= 1) {
+					return tkCode(tokens, i + 1) == SEMICOLON ? i + 2 : i + 1;
+				}
+				--depth;
+				break;
+		}
+	}
+}
+
+void parseEnd() {
+	free(marks);
+	marks = NULL;
+	nMarks = 0;
+	capMarks = 0;
+	freeScopes();
+}
+
+int parseErrorTk() {
+	// the errors do not change the position of the parser
+	return iTk;
+}
+
 void tkerr(const char *fmt, ...) {
-	fprintf(stderr, "Error at line %d: ", iTk->line);
+	tkCode(tokens, iTk);
 	va_list va;
 	va_start(va, fmt);
-	vfprintf(stderr, fmt, va);
-	va_end(va);
-	fprintf(stderr, "\n");
-	exit(EXIT_FAILURE);
+	verrAt(tkLine(tokens, iTk), fmt, va);
+}
+
+int consumedLine() {
+	return tkLine(tokens, consumedTk);
+}
+
+void exprNode(NodeKind kind, int line, Ret *r, NodeId a, NodeId b) {
+	NodeId id = astAdd(ast, kind, line);
+	Node *node = NODE(id);
+	node->type = r->type;
+	node->lval = r->lval;
+	node->ct = r->ct;
+	node->a = a;
+	node->b = b;
+	r->node = id;
+	r->known = false;
+}
+
+void constNode(Ret *r, int line, ConstVal val) {
+	r->lval = false;
+	r->ct = true;
+	switch (r->type) {
+		case TY_INT:
+			exprNode(N_INT, line, r, NO_NODE, NO_NODE);
+			NODE(r->node)->i = val.i;
+			break;
+		case TY_DOUBLE:
+			exprNode(N_DOUBLE, line, r, NO_NODE, NO_NODE);
+			NODE(r->node)->d = val.d;
+			break;
+		default:	// TY_CHAR
+			exprNode(N_CHAR, line, r, NO_NODE, NO_NODE);
+			NODE(r->node)->ch = val.ch;
+			break;
+	}
+	r->known = true;
+	r->val = val;
+}
+
+bool foldBinary(int op, Ret *a, Ret *b, TypeId t, ConstVal *val) {
+	if (op == AND || op == OR) {
+		// the right operand is not evaluated when the left one gives the result, so it can be dropped
+		if (a->known && knownTruth(a) == (op == OR)) {
+			val->i = op == OR;
+			return true;
+		}
+		if (!a->known || !b->known) {
+			return false;
+		}
+		val->i = knownTruth(b);
+		return true;
+	}
+	if (!a->known || !b->known) {
+		return false;
+	}
+	if (t == TY_DOUBLE) {
+		double x = a->type == TY_DOUBLE ? a->val.d : knownInt(a);
+		double y = b->type == TY_DOUBLE ? b->val.d : knownInt(b);
+		switch (op) {
+			case ADD: val->d = x + y; return true;
+			case SUB: val->d = x - y; return true;
+			case MUL: val->d = x * y; return true;
+			case DIV: val->d = x / y; return true;
+			case EQUAL: val->i = x == y; return true;
+			case NOTEQ: val->i = x != y; return true;
+			case LESS: val->i = x < y; return true;
+			case LESSEQ: val->i = x <= y; return true;
+			case GREATER: val->i = x > y; return true;
+			default: val->i = x >= y; return true;	// GREATEREQ
+		}
+	}
+	int x = knownInt(a), y = knownInt(b), v;
+	switch (op) {
+		// the VM wraps around on overflow
+		case ADD: v = (int) ((unsigned) x + (unsigned) y); break;
+		case SUB: v = (int) ((unsigned) x - (unsigned) y); break;
+		case MUL: v = (int) ((unsigned) x * (unsigned) y); break;
+		case DIV:
+			// the VM reports the division by zero when it runs
+			if (y == 0 || (x == INT_MIN && y == -1)) {
+				return false;
+			}
+			v = x / y;
+			break;
+		case EQUAL: val->i = x == y; return true;
+		case NOTEQ: val->i = x != y; return true;
+		case LESS: val->i = x < y; return true;
+		case LESSEQ: val->i = x <= y; return true;
+		case GREATER: val->i = x > y; return true;
+		default: val->i = x >= y; return true;	// GREATEREQ
+	}
+	if (t == TY_CHAR) {
+		// the VM does not truncate the result of an operation with chars, so a constant char cannot hold it
+		if (v != (char) v) {
+			return false;
+		}
+		val->ch = (char) v;
+	} else {
+		val->i = v;
+	}
+	return true;
+}
+
+bool foldUnary(NodeKind kind, Ret *a, TypeId t, ConstVal *val) {
+	// the known values are scalars, so their types are base types
+	if (!a->known || typeOf(t)->cls == TC_ARRAY) {
+		return false;
+	}
+	if (kind == N_NOT) {
+		val->i = !knownTruth(a);
+		return true;
+	}
+	if (kind == N_NEG) {
+		if (a->type == TY_DOUBLE) {
+			val->d = -a->val.d;
+			return true;
+		}
+		int v = (int) (0u - (unsigned) knownInt(a));
+		if (a->type == TY_CHAR) {
+			if (v != (char) v) {
+				return false;
+			}
+			val->ch = (char) v;
+		} else {
+			val->i = v;
+		}
+		return true;
+	}
+	// N_CAST
+	if (t == TY_DOUBLE) {
+		val->d = a->type == TY_DOUBLE ? a->val.d : knownInt(a);
+		return true;
+	}
+	int v;
+	if (a->type == TY_DOUBLE) {
+		// a value which does not fit in an int is left to the VM
+		if (!(a->val.d > (double) INT_MIN - 1 && a->val.d < (double) INT_MAX + 1)) {
+			return false;
+		}
+		v = (int) a->val.d;
+	} else {
+		v = knownInt(a);
+	}
+	if (t == TY_CHAR) {
+		val->ch = (char) v;
+	} else {
+		val->i = v;
+	}
+	return true;
+}
+
+int knownInt(Ret *r) {
+	return r->type == TY_CHAR ? r->val.ch : r->val.i;
+}
+
+bool knownTruth(Ret *r) {
+	return r->type == TY_DOUBLE ? r->val.d != 0 : knownInt(r) != 0;
+}
+
+void appendNode(NodeId *first, NodeId *last, NodeId id) {
+	if (*last) {
+		NODE(*last)->next = id;
+	} else {
+		*first = id;
+	}
+	*last = id;
+}
+
+NodeId fnNode(Symbol *fn, int line, NodeId body) {
+	NodeId node = astAdd(ast, N_FN, line);
+	NODE(node)->sym = fn;
+	NODE(node)->a = body;
+	appendNode(&ast->fns, &ast->lastFn, node);
+	return node;
+}
+
+int skipBody(int idx) {
+	int depth = 0;
+	for (int i = idx; ; ++i) {
+		int code = tkCode(tokens, i);
+		if (code == END) {
+			iTk = i;
+			tkerr("Missing \"}\"");
+		}
+		if (code == LACC) {
+			++depth;
+		} else if (code == RACC && !--depth) {
+			return i + 1;
+		}
+	}
 }
 
 bool consume(int code) {
-	if (iTk->code == code) {
-		consumedTk = iTk;
-		iTk = iTk->next;
+	if (tkCode(tokens, iTk) == code) {
+		consumedTk = iTk++;
+		if (!nMarks) {
+			tkRelease(tokens, consumedTk);
+		}
 		return true;
 	}
 	return false;
 }
 
+void mark() {
+	if (nMarks == capMarks) {
+		capMarks = capMarks ? capMarks * 2 : 16;
+		marks = safeRealloc(marks, capMarks * sizeof(int));
+	}
+	marks[nMarks++] = iTk;
+}
+
+void backtrack() {
+	iTk = marks[--nMarks];
+	if (!nMarks) {
+		tkRelease(tokens, iTk - 1);
+	}
+}
+
+void commit() {
+	if (!--nMarks) {
+		tkRelease(tokens, iTk - 1);
+	}
+}
+
 bool unit() {
 	for (;;) {
 		if (structDef()) {}
@@ -85,17 +460,16 @@ bool unit() {
 }
 
 bool structDef() {
-	Token *tk = iTk;
+	mark();
 	if (consume(STRUCT)) {
 		if (consume(ID)) {
-			Token *tkName = consumedTk;
+			int tkName = consumedTk;
 			if (consume(LACC)) {
-				Symbol *s = findSymbolInDomain(symTable, tkName->text);
-				if (s) tkerr("Symbol redefinition: %s", tkName->text);
-				s = addSymbolToDomain(symTable, newSymbol(tkName->text, SK_STRUCT));
-				s->type.tb = TB_STRUCT;
-				s->type.s = s;
-				s->type.n = -1;
+				Symbol *s = findSymbolInDomain(symTable, TK(tkName).atom);
+				if (s) tkerr("Symbol redefinition: %s", TK(tkName).atom->text);
+				s = addSymbolToDomain(symTable, newSymbol(TK(tkName).atom, SK_STRUCT));
+				s->type = typeIntern(TB_STRUCT, s, -1);
+				commit();
 				pushDomain();
 				owner = s;
 				for (;;) {
@@ -112,52 +486,53 @@ bool structDef() {
 			}
 		} else tkerr("Missing/invalid struct identifier");
 	}
-	iTk = tk;
+	backtrack();
 	return false;
 }
 
 static bool varDef() {
-	Token *tk = iTk;
+	mark();
 	Type t;
 	if (typeBase(&t)) {
 		if (consume(ID)) {
-			Token *tkName = consumedTk;
+			int tkName = consumedTk;
 			if (arrayDecl(&t)) {
 				if (t.n == 0) tkerr("An array must must have a specified dimension");
 			}
 			if (consume(SEMICOLON)) {
-				Symbol *var = findSymbolInDomain(symTable, tkName->text);
-				if (var) tkerr("Symbol redefinition: %s", tkName->text);
-				var = newSymbol(tkName->text, SK_VAR);
-				var->type = t;
-				var->owner = owner;
+				Symbol *var = findSymbolInDomain(symTable, TK(tkName).atom);
+				if (var) tkerr("Symbol redefinition: %s", TK(tkName).atom->text);
+				// a local var or a member is in the memory of its owner, so it stays valid after its domain is dropped
+				var = owner ? newMember(owner, TK(tkName).atom, SK_VAR) : newSymbol(TK(tkName).atom, SK_VAR);
+				var->type = typeIntern(t.tb, t.s, t.n);
 				addSymbolToDomain(symTable, var);
 				if (owner) {
 					switch (owner->kind) {
 						case SK_FN:
-							var->varIdx = symbolsLen(owner->fn.locals);
-							addSymbolToList(&owner->fn.locals, dupSymbol(var));
+							addLocal(owner, var);
 							break;
 						case SK_STRUCT:
-							var->varIdx = typeSize(&owner->type);
-							addSymbolToList(&owner->structMembers, dupSymbol(var));
+							if (t.tb == TB_STRUCT && t.s == owner) tkerr("The struct %s cannot contain itself", owner->name->text);
+							addStructMember(owner, var);
 							break;
 						default:  // not needed, stops unnecessary warnings
 							break;
 					}
 				} else {
-					var->varMem = safeAlloc(typeSize(&t));
+					addGlobalVar(symTable, var);
 				}
+				commit();
 				return true;
 			} else tkerr("Missing semicolon after variable declaration");
 		} else tkerr("Missing/invalid identifier after base type");
 	}
-	iTk = tk;
+	backtrack();
 	return false;
 }
 
 bool typeBase(Type *t) {
 	t->n = -1;
+	t->s = NULL;		// only a struct has a symbol
 	if (consume(TYPE_INT)) {
 		t->tb = TB_INT;
 		return true;
@@ -172,10 +547,10 @@ bool typeBase(Type *t) {
 	}
 	if (consume(STRUCT)) {
 		if (consume(ID)) {
-			Token *tkName = consumedTk;
+			int tkName = consumedTk;
 			t->tb = TB_STRUCT;
-			t->s = findSymbol(tkName->text);
-			if (!t->s) tkerr("Undefined struct: %s", tkName->text);
+			t->s = findSymbol(TK(tkName).atom);
+			if (!t->s) tkerr("Undefined struct: %s", TK(tkName).atom->text);
 			return true;
 		} else tkerr("Missing struct identifier");
 	}
@@ -185,8 +560,8 @@ bool typeBase(Type *t) {
 bool arrayDecl(Type *t) {
 	if (consume(LBRACKET)) {
 		if (consume(INT)) {
-			Token *tkSize = consumedTk;
-			t->n = tkSize->i;
+			int tkSize = consumedTk;
+			t->n = TK(tkSize).i;
 		} else {
 			t->n = 0;
 		}
@@ -198,7 +573,7 @@ bool arrayDecl(Type *t) {
 }
 
 bool fnDef() {
-	Token *tk = iTk;
+	mark();
 	Type t;
 	bool consumedVoidTk = false;
 	if (typeBase(&t) || (consumedVoidTk = consume(VOID))) {
@@ -206,13 +581,15 @@ bool fnDef() {
 			t.tb = TB_VOID;
 		}
 		if (consume(ID)) {
-			Token *tkName = consumedTk;
+			int tkName = consumedTk;
 			if (consume(LPAR)) {
-				Symbol *fn = findSymbolInDomain(symTable, tkName->text);
-				if (fn) tkerr("Symbol redefinition: %s", tkName->text);
-				fn = newSymbol(tkName->text, SK_FN);
-				fn->type = t;
+				Symbol *fn = findSymbolInDomain(symTable, TK(tkName).atom);
+				if (fn) tkerr("Symbol redefinition: %s", TK(tkName).atom->text);
+				fn = newSymbol(TK(tkName).atom, SK_FN);
+				fn->type = typeIntern(t.tb, t.s, t.n);
 				addSymbolToDomain(symTable, fn);
+				int line = tkLine(tokens, tkName);
+				commit();
 				owner = fn;
 				pushDomain();
 				if (fnParam()) {
@@ -222,59 +599,76 @@ bool fnDef() {
 					}
 				}
 				if (consume(RPAR)) {
-					if (stmCompound(false)) {
+					if (decl) {
+						// only the signature is parsed now, the body is parsed later by parseFnBody
+						if (tkCode(tokens, iTk) != LACC) tkerr("Missing function body in function definition");
+						decl->fn = fn;
+						decl->line = line;
+						decl->bodyTk = iTk;
+						iTk = decl->endTk = skipBody(iTk);
+						dropDomain();
+						owner = NULL;
+						return true;
+					}
+					NodeId body;
+					if (stmCompound(false, &body)) {
 						dropDomain();
 						owner = NULL;
+						fnNode(fn, line, body);
 						return true;
 					} else tkerr("Missing function body in function definition");
 				} else tkerr("Missing \")\" in fuction signature");
 			}
 		} else tkerr("Missing/invalid identifier after base type");
 	}
-	iTk = tk;
+	backtrack();
 	return false;
 }
 
 bool fnParam() {
-	Token *tk = iTk;
+	mark();
 	Type t;
 	if (typeBase(&t)) {
 		if (consume(ID)) {
-			Token *tkName = consumedTk;
+			int tkName = consumedTk;
 			if (arrayDecl(&t)) {
 				t.n = 0;
 			}
-			Symbol *param = findSymbolInDomain(symTable, tkName->text);
-			if (param) tkerr("Symbol redefinition: %s", tkName->text);
-			param = newSymbol(tkName->text, SK_PARAM);
-			param->type = t;
-			param->owner = owner;
-			param->paramIdx = symbolsLen(owner->fn.params);
+			Symbol *param = findSymbolInDomain(symTable, TK(tkName).atom);
+			if (param) tkerr("Symbol redefinition: %s", TK(tkName).atom->text);
+			param = newMember(owner, TK(tkName).atom, SK_PARAM);
+			param->type = typeIntern(t.tb, t.s, t.n);
 			addSymbolToDomain(symTable, param);
-			addSymbolToList(&owner->fn.params, dupSymbol(param));
+			addParam(owner, param);
+			commit();
 			return true;
 		} else tkerr("Missing/invalid identifier after base type");
 	}
-	iTk = tk;
+	backtrack();
 	return false;
 }
 
-bool stm() {
-	Token *tk = iTk;
+bool stm(NodeId *node) {
 	Ret rCond, rExpr;
-	if (stmCompound(true)) {
+	if (stmCompound(true, node)) {
 		return true;
 	}
 	if (consume(IF)) {
+		int line = consumedLine();
 		if (consume(LPAR)) {
 			if (expr(&rCond)) {
 				if (!canBeScalar(&rCond)) tkerr("The \"if\" condition must be a scalar value");
 				if (consume(RPAR)) {
-					if (stm()) {
+					NodeId thenStm, elseStm = NO_NODE;
+					if (stm(&thenStm)) {
 						if (consume(ELSE)) {
-							if (stm()) {}
+							if (stm(&elseStm)) {}
 							else tkerr("Missing/invalid statement after \"else\" keyword");
 						}
+						*node = astAdd(ast, N_IF, line);
+						NODE(*node)->a = rCond.node;
+						NODE(*node)->b = thenStm;
+						NODE(*node)->c = elseStm;
 						return true;
 					} else tkerr("Missing \"if\" statement body");
 				} else tkerr("Missing \")\" after \"if\" condition");
@@ -282,11 +676,16 @@ bool stm() {
 		} else tkerr("Missing \"(\" after \"if\" statement");
 	}
 	if (consume(WHILE)) {
+		int line = consumedLine();
 		if (consume(LPAR)) {
 			if (expr(&rCond)) {
         		if (!canBeScalar(&rCond)) tkerr("The \"while\" condition must be a scalar value");
 				if (consume(RPAR)) {
-					if (stm()) {
+					NodeId body;
+					if (stm(&body)) {
+						*node = astAdd(ast, N_WHILE, line);
+						NODE(*node)->a = rCond.node;
+						NODE(*node)->b = body;
 						return true;
 					} else tkerr("Missing \"while\" body");
 				} else tkerr("Missing \")\" after \"while\" condition");
@@ -294,37 +693,54 @@ bool stm() {
 		} else tkerr("Missing \"(\" after \"while\" statement");
 	}
 	if (consume(RETURN)) {
+		int line = consumedLine();
 		if (expr(&rExpr)) {
-			if (owner->type.tb == TB_VOID) tkerr("A void function cannot return a value");
+			if (owner->type == TY_VOID) tkerr("A void function cannot return a value");
 			if (!canBeScalar(&rExpr)) tkerr("The return value must be a scalar value");
-			if (!convTo(&rExpr.type, &owner->type)) tkerr("Cannot convert the return expression type to the function return type");
+			if (!convTo(rExpr.type, owner->type)) tkerr("Cannot convert the return expression type to the function return type");
 			if (consume(SEMICOLON)) {
+				*node = astAdd(ast, N_RETURN, line);
+				NODE(*node)->a = rExpr.node;
 				return true;
 			} else tkerr("Missing semicolon after \"return\" statement");
 		}
-        if (owner->type.tb != TB_VOID) tkerr("a non-void function must return a value");
+        if (owner->type != TY_VOID) tkerr("a non-void function must return a value");
 		if (consume(SEMICOLON)) {
+			*node = astAdd(ast, N_RETURN, line);
 			return true;
 		} else tkerr("Missing semicolon after \"return\" statement");
 	}
+	mark();
+	rExpr.node = NO_NODE;
 	if (expr(&rExpr)) {}
 	if (consume(SEMICOLON)) {
+		commit();
+		*node = astAdd(ast, N_EXPR, rExpr.node ? NODE(rExpr.node)->line : consumedLine());
+		NODE(*node)->a = rExpr.node;
 		return true;
 	}
-	iTk = tk;
+	backtrack();
 	return false;
 }
 
-bool stmCompound(bool newDomain) {
+bool stmCompound(bool newDomain, NodeId *node) {
 	if (consume(LACC)) {
+		int line = consumedLine();
 		if (newDomain) {
 			pushDomain();
 		}
-		while (varDef() || stm());
+		NodeId first = NO_NODE, last = NO_NODE, s;
+		for (;;) {
+			if (varDef()) {}
+			else if (stm(&s)) appendNode(&first, &last, s);
+			else break;
+		}
 		if (consume(RACC)) {
 			if (newDomain) {
 				dropDomain();
 			}
+			*node = astAdd(ast, N_BLOCK, line);
+			NODE(*node)->a = first;
 			return true;
 		} else tkerr("Missing \"}\"");
 	}
@@ -336,230 +752,100 @@ bool expr(Ret *r) {
 }
 
 bool exprAssign(Ret *r) {
-	Token *tk = iTk;
-	Ret rDst;
-	if (exprUnary(&rDst)) {
-		if (consume(ASSIGN)) {
+	// the first operand is parsed only once: it is the destination if it is a unary expression followed by "="
+	bool cast = castFollows();
+	if (exprCast(r)) {
+		if (!cast && consume(ASSIGN)) {
+			int line = consumedLine();
+			Ret rDst = *r;
 			if (exprAssign(r)) {
 				if (!rDst.lval) tkerr("The assignment destination must be a left-value");
 				if (rDst.ct) tkerr("The assignment destination cannot be a constant");
 				if (!canBeScalar(&rDst)) tkerr("The assignment destination must be a scalar");
 				if (!canBeScalar(r)) tkerr("The assignment source must be a scalar");
-				if (!convTo(&r->type, &rDst.type)) tkerr("The assignment source cannot be converted to the destination");
-				r->lval = false;
-				r->ct = true;
+				if (!convTo(r->type, rDst.type)) tkerr("The assignment source cannot be converted to the destination");
+				// the value of an assignment is the value stored in the destination
+				NodeId src = r->node;
+				*r = (Ret) { rDst.type, false, true };
+				exprNode(N_ASSIGN, line, r, rDst.node, src);
 				return true;
 			} else tkerr("Invalid/missing expression after \"=\" (assignment) operator");
-		} 
-	}
-	iTk = tk;
-	return exprOr(r);
-}
-
-bool exprOr(Ret *r) {
-	if (exprAnd(r)) {
-		return _exprOr(r);
-	}
-	return false;
-}
-
-bool _exprOr(Ret *r) {
-	if (consume(OR)) {
-		Ret right;
-		if (exprAnd(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("Invalid operand type for \"||\" (LOGICAL OR)");
-			*r = (Ret) { { TB_INT, NULL, -1 }, false, true };
-			_exprOr(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \"||\" (LOGICAL OR) operator");
-	}
-	return true;
-}
-
-bool exprAnd(Ret *r) {
-	if (exprEq(r)) {
-		_exprAnd(r);
-		return true;
-	}
-	return false;
-}
-
-bool _exprAnd(Ret *r) {
-	if (consume(AND)) {
-		Ret right;
-		if (exprEq(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("Invalid operand type for \"&&\" (LOGICAL AND)");
-			*r = (Ret) { { TB_INT, NULL, -1 }, false, true};
-			_exprAnd(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \"&&\" (LOGICAL AND) operator");
-	}
-	return true;
-}
-
-bool exprEq(Ret *r) {
-	if (exprRel(r)) {
-		_exprEq(r);
-		return true;
-	}
-	return false;
-}
-
-bool _exprEq(Ret *r) {
-	if (consume(EQUAL)) {
-		Ret right;
-		if (exprRel(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("Invalid operand type for \"==\" (EQUAL)");
-			*r = (Ret) { { TB_INT, NULL, -1 }, false, true };
-			_exprEq(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \"==\" (EQUAL) operator");
-	}
-	if (consume(NOTEQ)) {
-		Ret right;
-		if (exprRel(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("Invalid operand type for \"!=\" (NOT EQUAL)");
-			*r = (Ret) { { TB_INT, NULL, -1 }, false, true };
-			_exprEq(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \"!=\" (NOT EQUAL) operator");
-	}
-	return true;
-}
-
-bool exprRel(Ret *r) {
-	if (exprAdd(r)) {
-		_exprRel(r);
-		return true;
-	}
-	return false;
-}
-
-bool _exprRel(Ret *r) {
-	if (consume(LESS)) {
-		Ret right;
-		if (exprAdd(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("invalid operand type for \"<\" (LESS)");
-			*r = (Ret) { { TB_INT, NULL, -1 }, false, true };
-			_exprRel(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \"<\" (LESS) operator");
-	}
-	if (consume(LESSEQ)) {
-		Ret right;
-		if (exprAdd(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("invalid operand type for \"<=\" (LESS OR EQUAL)");
-			*r = (Ret) { { TB_INT, NULL, -1 }, false, true };
-			_exprRel(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \"<=\" (LESS OR EQUAL) operator");
-	}
-	if (consume(GREATER)) {
-		Ret right;
-		if (exprAdd(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("invalid operand type for \">\" (GREATER)");
-			*r = (Ret) { { TB_INT, NULL, -1 }, false, true };
-			_exprRel(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \">\" (GREATER) operator");
-	}
-	if (consume(GREATEREQ)) {
-		Ret right;
-		if (exprAdd(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("invalid operand type for \">=\" (GREATER OR EQUAL)");
-			*r = (Ret) { { TB_INT, NULL, -1 }, false, true };
-			_exprRel(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \">=\" (GREATER OR EQUAL) operator");
-	}
-	return true;
-}
-
-bool exprAdd(Ret *r) {
-	if (exprMul(r)) {
-		_exprAdd(r);
+		}
+		exprBinary(r, 1);
 		return true;
 	}
 	return false;
 }
 
-bool _exprAdd(Ret *r) {
-	if (consume(ADD)) {
-		Ret right;
-		if (exprMul(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("Invalid operand type for \"+\" (ADDITION) ");
-			*r = (Ret) { tDst, false, true };
-			_exprAdd(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \"+\" (ADDITION) operator");
-	}
-	if (consume(SUB)) {
+void exprBinary(Ret *r, int minPrec) {
+	for (;;) {
+		int code = tkCode(tokens, iTk);
+		const BinOp *op = &binOps[code];
+		if (op->prec < minPrec) {
+			return;
+		}
+		consume(code);
+		int line = consumedLine();
 		Ret right;
-		if (exprMul(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("Invalid operand type for \"-\" (SUBTRACTION)");
-			*r = (Ret) { tDst, false, true };
-			_exprAdd(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \"-\" (SUBTRACTION) operator");
-	}
-	return true;
-}
-
-bool exprMul(Ret *r) {
-	if (exprCast(r)) {
-		_exprMul(r);
-		return true;
+		if (exprCast(&right)) {
+			// the operators which bind stronger are added to the right operand
+			exprBinary(&right, op->prec + 1);
+			TypeId tDst;
+			if (!arithTypeTo(r->type, right.type, &tDst)) tkerr(op->typeErr);
+			Ret left = *r;
+			if (op->arith) {
+				*r = (Ret) { tDst, false, true };
+			} else {
+				*r = (Ret) { TY_INT, false, true };
+			}
+			ConstVal val;
+			if (foldBinary(code, &left, &right, tDst, &val)) {
+				constNode(r, line, val);
+			} else {
+				exprNode(N_BINARY, line, r, left.node, right.node);
+				NODE(r->node)->op = code;
+			}
+		} else tkerr(op->missingErr);
 	}
-	return false;
 }
 
-bool _exprMul(Ret *r) {
-	if (consume(MUL)) {
-		Ret right;
-		if (exprCast(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("Invalid operand type for \"*\" (MULTIPLICATION)");
-			*r = (Ret) { tDst, false, true };
-			_exprMul(r);
-			return true;
-		} else tkerr("Invalid/missing expression after \"*\" (MULTIPLICATION) operator");
+bool castFollows() {
+	if (tkCode(tokens, iTk) != LPAR) {
+		return false;
 	}
-	if (consume(DIV)) {
-		Ret right;
-		if (exprCast(&right)) {
-			Type tDst;
-			if (!arithTypeTo(&r->type, &right.type, &tDst)) tkerr("Invalid operand type for \"/\" (DIVISION)");
-			*r = (Ret) { tDst, false, true };
-			_exprMul(r);
+	switch (tkCode(tokens, iTk + 1)) {
+		case TYPE_INT:
+		case TYPE_DOUBLE:
+		case TYPE_CHAR:
+		case STRUCT:
 			return true;
-		} else tkerr("Invalid/missing expression after \"/\" (DIVISION) operator");
+		default:
+			return false;
 	}
-	return true;
 }
 
 bool exprCast(Ret *r) {
-	if (consume(LPAR)) {
+	if (castFollows()) {
+		consume(LPAR);
+		int line = consumedLine();
 		Type t;
 		Ret op;
 		if (typeBase(&t)) {
 			if (arrayDecl(&t)) {}
 			if (consume(RPAR)) {
 				if (exprCast(&op)) {
+					const Type *tOp = typeOf(op.type);
 					if (t.tb == TB_STRUCT) tkerr("Cannot convert to a struct type");
-					if (op.type.tb == TB_STRUCT) tkerr("Cannot convert a struct");
-					if (op.type.n >= 0 && t.n < 0) tkerr("An array can only be converted to another array");
-					if (op.type.n < 0 && t.n >= 0) tkerr("A scalar can only be converted to another scalar");
-					*r = (Ret) { t, false, true };
+					if (tOp->tb == TB_STRUCT) tkerr("Cannot convert a struct");
+					if (tOp->n >= 0 && t.n < 0) tkerr("An array can only be converted to another array");
+					if (tOp->n < 0 && t.n >= 0) tkerr("A scalar can only be converted to another scalar");
+					*r = (Ret) { typeIntern(t.tb, t.s, t.n), false, true };
+					ConstVal val;
+					if (foldUnary(N_CAST, &op, r->type, &val)) {
+						constNode(r, line, val);
+					} else {
+						exprNode(N_CAST, line, r, op.node, NO_NODE);
+					}
 					return true;
 				} else tkerr("Invalid/missing expression to be casted");
 			} else tkerr("Missing \")\" after cast expression");
@@ -570,18 +856,33 @@ bool exprCast(Ret *r) {
 
 bool exprUnary(Ret *r) {
 	if (consume(SUB)) {
+		int line = consumedLine();
 		if (exprUnary(r)) {
 			if (!canBeScalar(r)) tkerr("Unary \"-\" (MINUS) must have a scalar operand");
 			r->lval = false;
 			r->ct = true;
+			ConstVal val;
+			if (foldUnary(N_NEG, r, r->type, &val)) {
+				constNode(r, line, val);
+			} else {
+				exprNode(N_NEG, line, r, r->node, NO_NODE);
+			}
 			return true;
 		} else tkerr("Invalid/missing expression after \"-\" (MINUS)");
 	}
 	if (consume(NOT)) {
+		int line = consumedLine();
 		if (exprUnary(r)) {
 			if (!canBeScalar(r)) tkerr("Unary \"!\" (LOGICAL NOT) must have a scalar operand");
-			r->lval = false;
-			r->ct = true;
+			// the value of "!" is an int, whatever the type of its operand
+			Ret op = *r;
+			*r = (Ret) { TY_INT, false, true };
+			ConstVal val;
+			if (foldUnary(N_NOT, &op, r->type, &val)) {
+				constNode(r, line, val);
+			} else {
+				exprNode(N_NOT, line, r, op.node, NO_NODE);
+			}
 			return true;
 		} else tkerr("Invalid/missing expression after \"!\" (LOGICAL NOT)");
 	}
@@ -598,27 +899,33 @@ bool exprPostfix(Ret *r) {
 
 bool _exprPostfix(Ret *r) {
 	if (consume(LBRACKET)) {
+		int line = consumedLine();
 		Ret idx;
 		if (expr(&idx)) {
 			if (consume(RBRACKET)) {
-				if (r->type.n < 0) tkerr("Only an array can be indexed");
-				Type tInt = { TB_INT, NULL, -1 };
-				if (!convTo(&idx.type, &tInt)) tkerr("The array index is not convertible to int");
-				r->type.n = -1;
+				if (typeOf(r->type)->cls != TC_ARRAY) tkerr("Only an array can be indexed");
+				if (!convTo(idx.type, TY_INT)) tkerr("The array index is not convertible to int");
+				r->type = typeOf(r->type)->elem;
 				r->lval = true;
 				r->ct = false;
+				exprNode(N_INDEX, line, r, r->node, idx.node);
 				_exprPostfix(r);
 				return true;
 			} else tkerr("Missing \"]\" after expression");
 		} else tkerr("Invalid/missing expression after \"[\"");
 	}
 	if (consume(DOT)) {
+		int line = consumedLine();
 		if (consume(ID)) {
-			Token *tkName = consumedTk;
-            if (r->type.tb != TB_STRUCT ) tkerr("A field can only be selected from a struct");
-            Symbol *s = findSymbolInList(r->type.s->structMembers, tkName->text);
-            if (!s) tkerr("The struct %s does not have a field %s", r->type.s->name, tkName->text);
-            *r = (Ret) { s->type, true, s->type.n >= 0 };
+			int tkName = consumedTk;
+            const Type *t = typeOf(r->type);
+            if (t->tb != TB_STRUCT ) tkerr("A field can only be selected from a struct");
+            Symbol *s = findStructMember(t->s, TK(tkName).atom);
+            if (!s) tkerr("The struct %s does not have a field %s", t->s->name->text, TK(tkName).atom->text);
+            NodeId base = r->node;
+            *r = (Ret) { s->type, true, typeOf(s->type)->cls == TC_ARRAY };
+			exprNode(N_FIELD, line, r, base, NO_NODE);
+			NODE(r->node)->sym = s;
 			_exprPostfix(r);
 			return true;
 		} else tkerr("Invalid/missing identifier after \".\" (dot) operator");
@@ -628,57 +935,72 @@ bool _exprPostfix(Ret *r) {
 
 bool exprPrimary(Ret *r) {
 	if (consume(ID)) {
-		Token *tkName = consumedTk;
-        Symbol *s = findSymbol(tkName->text);
-        if (!s) { tkerr("Undefined identifier: %s", tkName->text); }
+		int tkName = consumedTk;
+		int line = consumedLine();
+        Symbol *s = findSymbol(TK(tkName).atom);
+        if (!s) { tkerr("Undefined identifier: %s", TK(tkName).atom->text); }
 		if (consume(LPAR)) {
 			if (s->kind != SK_FN) tkerr("Only a function can be called");
 			Ret rArg;
-			Symbol *param = s->fn.params;
+			Symbol **params = s->fn.params;
+			int nParams = s->fn.nParams, nArgs = 0;
+			NodeId first = NO_NODE, last = NO_NODE;
 			if (expr(&rArg)) {
-				if (!param) tkerr("Too many arguments in function call");
-				if (!convTo(&rArg.type, &param->type)) tkerr("Cannot convert the argument type to the parameter type during function call");
-				param = param->next;
+				if (nArgs == nParams) tkerr("Too many arguments in function call");
+				if (!convTo(rArg.type, params[nArgs++]->type)) tkerr("Cannot convert the argument type to the parameter type during function call");
+				appendNode(&first, &last, rArg.node);
 				while (consume(COMMA)) {
 					if (expr(&rArg)) {
-						if (!param) tkerr("Too many arguments in function call");
-						if (!convTo(&rArg.type,&param->type)) tkerr("Cannot convert the argument type to the parameter type during function call");
-						param = param->next;
+						if (nArgs == nParams) tkerr("Too many arguments in function call");
+						if (!convTo(rArg.type, params[nArgs++]->type)) tkerr("Cannot convert the argument type to the parameter type during function call");
+						appendNode(&first, &last, rArg.node);
 					} else tkerr("Missing/invalid expression after \",\"");
 				}
 			}
 			if (consume(RPAR)) {
-				if (param) tkerr("Too few arguments in function call");
+				if (nArgs < nParams) tkerr("Too few arguments in function call");
 				*r = (Ret) { s->type, false, true };
+				exprNode(N_CALL, line, r, first, NO_NODE);
+				NODE(r->node)->sym = s;
 				return true;
 			} else tkerr("Missing \")\" after expression");
 		}
         if (s->kind == SK_FN) tkerr("A function can only be called");
-        *r = (Ret) { s->type, true, s->type.n >= 0 };
+        *r = (Ret) { s->type, true, typeOf(s->type)->cls == TC_ARRAY };
+		exprNode(N_VAR, line, r, NO_NODE, NO_NODE);
+		NODE(r->node)->sym = s;
 		return true;
 	}
 	if (consume(INT)) {
-		*r = (Ret) { { TB_INT, NULL, -1 }, false, true };
+		*r = (Ret) { TY_INT, false, true };
+		constNode(r, consumedLine(), (ConstVal) { .i = TK(consumedTk).i });
 		return true;
 	}
 	if (consume(DOUBLE)) {
-		*r = (Ret) { { TB_DOUBLE, NULL, -1 }, false, true };
+		*r = (Ret) { TY_DOUBLE, false, true };
+		constNode(r, consumedLine(), (ConstVal) { .d = TK(consumedTk).d });
 		return true;
 	}
 	if (consume(CHAR)) {
-		*r = (Ret) { { TB_CHAR, NULL, -1 }, false, true };
+		*r = (Ret) { TY_CHAR, false, true };
+		constNode(r, consumedLine(), (ConstVal) { .ch = TK(consumedTk).c });
 		return true;
 	}
 	if (consume(STRING)) {
-		*r = (Ret) { { TB_CHAR, NULL, 0 }, false, true };
+		*r = (Ret) { TY_STRING, false, true };
+		exprNode(N_STRING, consumedLine(), r, NO_NODE, NO_NODE);
+		Node *node = NODE(r->node);
+		node->str.len = TK(consumedTk).str.len;
+		node->str.chars = arenaStrndup(&ast->text, tkStr(tokens, consumedTk), node->str.len);
 		return true;
 	}
-	if (consume(LPAR)) {
+	// a cast is not a primary expression
+	if (!castFollows() && consume(LPAR)) {
 		if (expr(r)) {
 			if (consume(RPAR)) {
 				return true;
 			} else tkerr("Missing \")\" after expression");
-		}
+		} else tkerr("Invalid/missing expression after \"(\"");
 	}
 	return false;
 }
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include "scan.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+ScanFn scanSkip[NUM_SKIPS];
+
+static bool initialized = false;
+static ScanLevel current = SCAN_SCALAR;	// the selected kernels
+
+// for each char, the bit (1 << SKIP_*) is set if the char continues a run of that kind
+static unsigned char runChars[256];
+
+static void initRunChars() {
+	for (int c = 1; c < 256; ++c) {
+		unsigned char bits = 0;
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			bits |= 1 << SKIP_BLANKS;
+		}
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_') {
+			bits |= 1 << SKIP_ID;
+		}
+		if (c >= '0' && c <= '9') {
+			bits |= 1 << SKIP_DIGITS;
+		}
+		if (c != '\r' && c != '\n') {
+			bits |= 1 << SKIP_COMMENT;
+		}
+		if (c != '"' && c != '\\' && c != '\r' && c != '\n') {
+			bits |= 1 << SKIP_STRING;
+		}
+		runChars[c] = bits;
+	}
+	runChars[0] = 0;
+}
+
+// scalar kernels: one char per step
+
+#define SCALAR_KERNEL(name, kind) \
+	static const char *name(const char *p) { \
+		while (runChars[(unsigned char) *p] & (1 << kind)) { \
+			++p; \
+		} \
+		return p; \
+	}
+
+SCALAR_KERNEL(skipBlanksScalar, SKIP_BLANKS)
+SCALAR_KERNEL(skipIdScalar, SKIP_ID)
+SCALAR_KERNEL(skipDigitsScalar, SKIP_DIGITS)
+SCALAR_KERNEL(skipCommentScalar, SKIP_COMMENT)
+SCALAR_KERNEL(skipStringScalar, SKIP_STRING)
+
+#ifdef SCAN_X86
+
+/*
+	SIMD kernels: each step classifies a whole aligned block and builds a mask with a bit
+	for each char which stops the run. The first block is aligned down and the bits of
+	the chars before p are shifted out.
+
+	The last block can read past the end of the buffer. This is safe because a run always stops at
+	the final '\0' of the source, and an aligned block never crosses a page, so it is in the same
+	page as that '\0'. AddressSanitizer would still report the chars read past the end, so it does not
+	check the kernels.
+*/
+
+#define SIMD_KERNEL(name, isa, vec, width, load, stopMask) \
+	__attribute__((target(isa), no_sanitize_address)) static const char *name(const char *p) { \
+		size_t misalign = (uintptr_t) p & (width - 1); \
+		const vec *b = (const vec*) (p - misalign); \
+		unsigned mask = stopMask(load(b)) >> misalign; \
+		if (mask) { \
+			return p + __builtin_ctz(mask); \
+		} \
+		for (;;) { \
+			++b; \
+			mask = stopMask(load(b)); \
+			if (mask) { \
+				return (const char*) b + __builtin_ctz(mask); \
+			} \
+		} \
+	}
+
+// SSE2, 16 chars per step
+
+// the chars for which (c - lo) < n, as unsigned values
+#define SSE2_RANGE(x, lo, n) _mm_cmplt_epi8(_mm_sub_epi8(x, _mm_set1_epi8((char) ((lo) + 128))), _mm_set1_epi8((char) ((n) - 128)))
+#define SSE2_EQ(x, c) _mm_cmpeq_epi8(x, _mm_set1_epi8(c))
+#define SSE2_STOP(x) ((unsigned) _mm_movemask_epi8(x))
+#define SSE2_NOT_IN(x) (~SSE2_STOP(x) & 0xFFFFu)
+
+__attribute__((target("sse2"))) static inline unsigned stopBlanks16(__m128i x) {
+	return SSE2_NOT_IN(_mm_or_si128(_mm_or_si128(SSE2_EQ(x, ' '), SSE2_EQ(x, '\t')), _mm_or_si128(SSE2_EQ(x, '\r'), SSE2_EQ(x, '\n'))));
+}
+
+__attribute__((target("sse2"))) static inline unsigned stopId16(__m128i x) {
+	__m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+	return SSE2_NOT_IN(_mm_or_si128(_mm_or_si128(SSE2_RANGE(lower, 'a', 26), SSE2_RANGE(x, '0', 10)), SSE2_EQ(x, '_')));
+}
+
+__attribute__((target("sse2"))) static inline unsigned stopDigits16(__m128i x) {
+	return SSE2_NOT_IN(SSE2_RANGE(x, '0', 10));
+}
+
+__attribute__((target("sse2"))) static inline unsigned stopComment16(__m128i x) {
+	return SSE2_STOP(_mm_or_si128(_mm_or_si128(SSE2_EQ(x, '\r'), SSE2_EQ(x, '\n')), SSE2_EQ(x, 0)));
+}
+
+__attribute__((target("sse2"))) static inline unsigned stopString16(__m128i x) {
+	return SSE2_STOP(_mm_or_si128(_mm_or_si128(_mm_or_si128(SSE2_EQ(x, '"'), SSE2_EQ(x, '\\')), _mm_or_si128(SSE2_EQ(x, '\r'), SSE2_EQ(x, '\n'))), SSE2_EQ(x, 0)));
+}
+
+SIMD_KERNEL(skipBlanksSse2, "sse2", __m128i, 16, _mm_load_si128, stopBlanks16)
+SIMD_KERNEL(skipIdSse2, "sse2", __m128i, 16, _mm_load_si128, stopId16)
+SIMD_KERNEL(skipDigitsSse2, "sse2", __m128i, 16, _mm_load_si128, stopDigits16)
+SIMD_KERNEL(skipCommentSse2, "sse2", __m128i, 16, _mm_load_si128, stopComment16)
+SIMD_KERNEL(skipStringSse2, "sse2", __m128i, 16, _mm_load_si128, stopString16)
+
+// AVX2, 32 chars per step
+
+#define AVX2_RANGE(x, lo, n) _mm256_cmpgt_epi8(_mm256_set1_epi8((char) ((n) - 128)), _mm256_sub_epi8(x, _mm256_set1_epi8((char) ((lo) + 128))))
+#define AVX2_EQ(x, c) _mm256_cmpeq_epi8(x, _mm256_set1_epi8(c))
+#define AVX2_STOP(x) ((unsigned) _mm256_movemask_epi8(x))
+#define AVX2_NOT_IN(x) (~AVX2_STOP(x))
+
+__attribute__((target("avx2"))) static inline unsigned stopBlanks32(__m256i x) {
+	return AVX2_NOT_IN(_mm256_or_si256(_mm256_or_si256(AVX2_EQ(x, ' '), AVX2_EQ(x, '\t')), _mm256_or_si256(AVX2_EQ(x, '\r'), AVX2_EQ(x, '\n'))));
+}
+
+__attribute__((target("avx2"))) static inline unsigned stopId32(__m256i x) {
+	__m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+	return AVX2_NOT_IN(_mm256_or_si256(_mm256_or_si256(AVX2_RANGE(lower, 'a', 26), AVX2_RANGE(x, '0', 10)), AVX2_EQ(x, '_')));
+}
+
+__attribute__((target("avx2"))) static inline unsigned stopDigits32(__m256i x) {
+	return AVX2_NOT_IN(AVX2_RANGE(x, '0', 10));
+}
+
+__attribute__((target("avx2"))) static inline unsigned stopComment32(__m256i x) {
+	return AVX2_STOP(_mm256_or_si256(_mm256_or_si256(AVX2_EQ(x, '\r'), AVX2_EQ(x, '\n')), AVX2_EQ(x, 0)));
+}
+
+__attribute__((target("avx2"))) static inline unsigned stopString32(__m256i x) {
+	return AVX2_STOP(_mm256_or_si256(_mm256_or_si256(_mm256_or_si256(AVX2_EQ(x, '"'), AVX2_EQ(x, '\\')), _mm256_or_si256(AVX2_EQ(x, '\r'), AVX2_EQ(x, '\n'))), AVX2_EQ(x, 0)));
+}
+
+SIMD_KERNEL(skipBlanksAvx2, "avx2", __m256i, 32, _mm256_load_si256, stopBlanks32)
+SIMD_KERNEL(skipIdAvx2, "avx2", __m256i, 32, _mm256_load_si256, stopId32)
+SIMD_KERNEL(skipDigitsAvx2, "avx2", __m256i, 32, _mm256_load_si256, stopDigits32)
+SIMD_KERNEL(skipCommentAvx2, "avx2", __m256i, 32, _mm256_load_si256, stopComment32)
+SIMD_KERNEL(skipStringAvx2, "avx2", __m256i, 32, _mm256_load_si256, stopString32)
+
+#endif
+
+bool scanSupported(ScanLevel level) {
+	switch (level) {
+		case SCAN_SCALAR:
+			return true;
+#ifdef SCAN_X86
+		case SCAN_SSE2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse2");
+		case SCAN_AVX2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2");
+#endif
+		default:
+			return false;
+	}
+}
+
+void scanUse(ScanLevel level) {
+	if (!scanSupported(level)) {
+		err("The %s scanning kernels are not supported by this CPU", scanLevelName(level));
+	}
+	initRunChars();
+	scanSkip[SKIP_NONE] = NULL;
+	switch (level) {
+#ifdef SCAN_X86
+		case SCAN_AVX2:
+			scanSkip[SKIP_BLANKS] = skipBlanksAvx2;
+			scanSkip[SKIP_ID] = skipIdAvx2;
+			scanSkip[SKIP_DIGITS] = skipDigitsAvx2;
+			scanSkip[SKIP_COMMENT] = skipCommentAvx2;
+			scanSkip[SKIP_STRING] = skipStringAvx2;
+			break;
+		case SCAN_SSE2:
+			scanSkip[SKIP_BLANKS] = skipBlanksSse2;
+			scanSkip[SKIP_ID] = skipIdSse2;
+			scanSkip[SKIP_DIGITS] = skipDigitsSse2;
+			scanSkip[SKIP_COMMENT] = skipCommentSse2;
+			scanSkip[SKIP_STRING] = skipStringSse2;
+			break;
+#endif
+		default:
+			scanSkip[SKIP_BLANKS] = skipBlanksScalar;
+			scanSkip[SKIP_ID] = skipIdScalar;
+			scanSkip[SKIP_DIGITS] = skipDigitsScalar;
+			scanSkip[SKIP_COMMENT] = skipCommentScalar;
+			scanSkip[SKIP_STRING] = skipStringScalar;
+	}
+	current = level;
+	initialized = true;
+}
+
+ScanLevel scanInit() {
+	if (!initialized) {
+		if (scanSupported(SCAN_AVX2)) {
+			scanUse(SCAN_AVX2);
+		} else if (scanSupported(SCAN_SSE2)) {
+			scanUse(SCAN_SSE2);
+		} else {
+			scanUse(SCAN_SCALAR);
+		}
+	}
+	return current;
+}
+
+const char *scanLevelName(ScanLevel level) {
+	switch (level) {
+		case SCAN_SSE2: return "SSE2";
+		case SCAN_AVX2: return "AVX2";
+		default: return "scalar";
+	}
+}
@@ -4,12 +4,17 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define NUM_POSSIBLE_TOKENS 38
 #define MAX_TOKEN_NAME_LEN 16
 
 static int stdout_fd = -1;
 
+_Thread_local ErrTrap *errTrap = NULL;
+
 // must be in the same order as the Token codes
 static const char TOKEN_NAMES[NUM_POSSIBLE_TOKENS][MAX_TOKEN_NAME_LEN] = {
 	"ID",
@@ -19,16 +24,43 @@ static const char TOKEN_NAMES[NUM_POSSIBLE_TOKENS][MAX_TOKEN_NAME_LEN] = {
 	"ADD", "SUB", "MUL", "DIV", "DOT", "AND", "OR", "NOT", "ASSIGN", "EQUAL", "NOTEQ", "LESS", "LESSEQ", "GREATER", "GREATEREQ"
 };
 
-void err(const char *fmt, ...) {
-	fprintf(stderr, "Error: ");
-	va_list va;
-	va_start(va, fmt);
+// shows the error and ends the program, or saves the error in errTrap and jumps to it
+static noreturn void reportError(int line, bool showLine, const char *fmt, va_list va) {
+	if (errTrap) {
+		vsnprintf(errTrap->msg, ERR_MSG_SIZE, fmt, va);
+		errTrap->line = line;
+		longjmp(errTrap->env, 1);
+	}
+	if (showLine) {
+		fprintf(stderr, "Error at line %d: ", line);
+	} else {
+		fprintf(stderr, "Error: ");
+	}
 	vfprintf(stderr, fmt, va);
-	va_end(va);
 	fprintf(stderr, "\n");
 	exit(EXIT_FAILURE);
 }
 
+void err(const char *fmt, ...) {
+	va_list va;
+	va_start(va, fmt);
+	reportError(0, false, fmt, va);
+}
+
+void errLine(int line, const char *fmt, ...) {
+	va_list va;
+	va_start(va, fmt);
+	reportError(line, false, fmt, va);
+}
+
+void verrAt(int line, const char *fmt, va_list va) {
+	reportError(line, true, fmt, va);
+}
+
+void errRethrow(ErrTrap *trap) {
+	errLine(trap->line, "%s", trap->msg);
+}
+
 void *safeAlloc(size_t nBytes) {
 	void *p=malloc(nBytes);
 	if (!p) {
@@ -37,24 +69,84 @@ void *safeAlloc(size_t nBytes) {
 	return p;
 }
 
-char *loadFile(const char *fileName) {
-	FILE *fis = fopen(fileName, "rb");
-	if (!fis) {
-		err("Unable to open %s", fileName);
+void *safeRealloc(void *p, size_t nBytes) {
+	p = realloc(p, nBytes);
+	if (!p) {
+		err("Not enough memory");
 	}
-	fseek(fis, 0, SEEK_END);
-	size_t n = (size_t) ftell(fis);
-	fseek(fis, 0, SEEK_SET);
-	char *buf = (char*) safeAlloc((size_t) n + 1);
-	size_t nRead = fread(buf, sizeof(char), (size_t) n, fis);
-	fclose(fis);
-	if (n != nRead) {
-		err("Cannot read all the content of %s", fileName);
+	return p;
+}
+
+// reads the whole file into an allocated buffer
+static char *readFile(int fd, const char *fileName, size_t *len) {
+	size_t n = 0, cap = 64 * 1024;
+	char *buf = (char*) safeAlloc(cap + 1);
+	for (;;) {
+		ssize_t nRead = read(fd, buf + n, cap - n);
+		if (nRead < 0) {
+			err("Cannot read all the content of %s", fileName);
+		}
+		if (nRead == 0) {
+			break;
+		}
+		n += nRead;
+		if (n == cap) {
+			cap *= 2;
+			buf = (char*) safeRealloc(buf, cap + 1);
+		}
 	}
 	buf[n] = '\0';
+	*len = n;
 	return buf;
 }
 
+Source *loadSource(const char *fileName) {
+	int fd = open(fileName, O_RDONLY);
+	if (fd == -1) {
+		err("Unable to open %s", fileName);
+	}
+	Source *src = (Source*) safeAlloc(sizeof(Source));
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		/* 
+			Reserve one byte more than the file, rounded up to whole pages, with an anonymous
+			zero-filled mapping and map the file over its beginning. The bytes after the end
+			of the file are always zero, so the text is '\0' terminated without being copied.
+		*/
+		size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+		size_t len = (size_t) st.st_size;
+		size_t mapLen = (len + 1 + pageSize - 1) & ~(pageSize - 1);
+		char *map = mmap(NULL, mapLen, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map != MAP_FAILED) {
+			if (mmap(map, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED) {
+				madvise(map, len, MADV_SEQUENTIAL);
+				close(fd);
+				src->text = map;
+				src->len = len;
+				src->mapped = true;
+				src->mapLen = mapLen;
+				return src;
+			}
+			munmap(map, mapLen);
+		}
+	}
+	// pipes, empty files or a failed mapping
+	src->text = readFile(fd, fileName, &src->len);
+	src->mapped = false;
+	src->mapLen = 0;
+	close(fd);
+	return src;
+}
+
+void freeSource(Source *src) {
+	if (src->mapped) {
+		munmap((void*) src->text, src->mapLen);
+	} else {
+		free((void*) src->text);
+	}
+	free(src);
+}
+
 FILE *createOutputStream(const char *fileName) {
 	FILE *stream = fopen(fileName, "w");
 	if (!stream) {
@@ -1,14 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
 
 #include "utils.h"
 #include "ad.h"
 
-#define MAXSTACK 10000
+#define GLOBALS_ALIGN 64
 
-static Val stack[MAXSTACK];  // the stack
-static Val *SP = stack - 1;  // Stack pointer - the stack's top - points to the value from the top of the stack
-static Val *FP = NULL;		 // the initial value doesn't matter
+// the machine which runs on the calling thread, set by run
+static _Thread_local Vm *vm;
 
 Instr *addInstr(Instr **list, Opcode op) {
 	Instr *i = (Instr *)safeAlloc(sizeof(Instr));
@@ -34,6 +36,13 @@ Instr *insertInstr(Instr *before, int op) {
 	return i;
 }
 
+void freeInstrs(Instr *list) {
+	for (Instr *next; list; list = next) {
+		next = list->next;
+		free(list);
+	}
+}
+
 void delInstrAfter(Instr *instr) {
 	if (!instr) {
 		return;
@@ -67,80 +76,150 @@ Instr *addInstrWithDouble(Instr **list, Opcode op, double argVal) {
 }
 
 void pushv(Val v) {
-	if (SP + 1 == stack + MAXSTACK) {
+	if (vm->SP + 1 == vm->stack + MAXSTACK) {
 		err("Trying to push into a full stack");
 	}
-	*++SP = v;
+	*++vm->SP = v;
 }
 
 Val popv() {
-	if (SP == stack - 1) {
+	if (vm->SP == vm->stack - 1) {
 		err("Trying to pop from empty stack");
 	}
-	return *SP--;
+	return *vm->SP--;
 }
 
 void pushi(int i) {
-	if (SP + 1 == stack + MAXSTACK) {
+	if (vm->SP + 1 == vm->stack + MAXSTACK) {
 		err("Trying to push into a full stack");
 	}
-	(++SP)->i = i;
+	(++vm->SP)->i = i;
 }
 
 int popi() {
-	if (SP == stack - 1) {
+	if (vm->SP == vm->stack - 1) {
 		err("trying to pop from empty stack");
 	}
-	return SP--->i;
+	return vm->SP--->i;
 }
 
 double popf() {
-	if (SP == stack - 1) {
+	if (vm->SP == vm->stack - 1) {
 		err("Trying to pop from empty stack");
 	}
-	return SP--->f;
+	return vm->SP--->f;
 }
 
 void pushf(double f) {
-	if (SP + 1 == stack + MAXSTACK) {
+	if (vm->SP + 1 == vm->stack + MAXSTACK) {
 		err("Trying to push into a full stack");
 	}
-	(++SP)->f = f;
+	(++vm->SP)->f = f;
 }
 
 void pushp(void *p) {
-	if (SP + 1 == stack + MAXSTACK) {
+	if (vm->SP + 1 == vm->stack + MAXSTACK) {
 		err("Trying to push into a full stack");
 	}
-	(++SP)->p = p;
+	(++vm->SP)->p = p;
 }
 
 void *popp() {
-	if (SP == stack - 1) {
+	if (vm->SP == vm->stack - 1) {
 		err("Trying to pop from empty stack");
 	}
-	return SP--->p;
+	return vm->SP--->p;
 }
 
 void put_i() {
-	printf("=> %d", popi());
+	fprintf(vm->out, "=> %d", popi());
 }
 
 void put_d() {
-	printf("=> %f", popf());
+	fprintf(vm->out, "=> %f", popf());
+}
+
+Vm *newVm(FILE *out) {
+	Vm *m = (Vm*) safeAlloc(sizeof(Vm));
+	m->SP = m->stack - 1;
+	m->FP = NULL;
+	m->trace = false;
+	m->out = out;
+	m->sandbox = false;
+	m->budget = 0;
+	m->genLazy = NULL;
+	m->globals = NULL;
+	m->globalsSize = 0;
+	return m;
+}
+
+void freeVm(Vm *m) {
+	free(m->globals);
+	free(m);
+}
+
+void vmGlobals(Vm *m, int size) {
+	// aligned_alloc needs a size which is a multiple of the alignment
+	size_t n = ((size_t) size + GLOBALS_ALIGN) / GLOBALS_ALIGN * GLOBALS_ALIGN;
+	char *globals = (char*) aligned_alloc(GLOBALS_ALIGN, n);
+	if (!globals) {
+		err("Not enough memory");
+	}
+	memset(globals, 0, n);
+	free(m->globals);
+	m->globals = globals;
+	m->globalsSize = size;
 }
 
 void vmInit() {
 	Symbol *fn = NULL;
 	
-	fn = addExtFn("put_i", put_i, (Type){TB_VOID, NULL, -1});
-	addFnParam(fn, "i", (Type){TB_INT, NULL, -1});
+	fn = addExtFn("put_i", put_i, TY_VOID);
+	addFnParam(fn, "i", TY_INT);
 
-	fn = addExtFn("put_d", put_d, (Type){TB_VOID, NULL, -1});
-	addFnParam(fn, "i", (Type){TB_DOUBLE, NULL, -1});
+	fn = addExtFn("put_d", put_d, TY_VOID);
+	addFnParam(fn, "i", TY_DOUBLE);
 }
 
-void run(Instr *IP) {
+// shows the executed instructions only if the trace of the machine is on
+#define TRACE(...) if (vm->trace) fprintf(vm->out, __VA_ARGS__)
+
+// counts a call or a jump; only a loop or a recursion can make the code run for long
+#define SPEND() if (vm->budget && !--vm->budget) err("Run: the budget of steps is exhausted")
+
+// in a sandbox, the code can use only the memory of the stack, so a wrong address stops it with an error
+#define CHECK_MEM(p, n) if (vm->sandbox && !inStack(p, n)) err("Run: the memory outside the stack cannot be used in a sandbox")
+
+static bool inStack(const void *p, size_t n) {
+	uintptr_t begin = (uintptr_t) vm->stack, end = (uintptr_t) (vm->stack + MAXSTACK), a = (uintptr_t) p;
+	return a >= begin && a <= end && n <= end - a;
+}
+
+// the binary operations, which take 2 values from stack and put the result on stack
+#define BINARY_I(name, sign, expr) \
+	iTop = popi(); \
+	iBefore = popi(); \
+	pushi(expr); \
+	TRACE(name "\t// %d" sign "%d -> %d", iBefore, iTop, expr); \
+	IP = IP->next; \
+	break;
+#define BINARY_F(name, sign, expr) \
+	fTop = popf(); \
+	fBefore = popf(); \
+	pushf(expr); \
+	TRACE(name "\t// %g" sign "%g -> %g", fBefore, fTop, (double) (expr)); \
+	IP = IP->next; \
+	break;
+#define COMPARE_F(name, sign, expr) \
+	fTop = popf(); \
+	fBefore = popf(); \
+	pushi(expr); \
+	TRACE(name "\t// %g" sign "%g -> %d", fBefore, fTop, expr); \
+	IP = IP->next; \
+	break;
+
+void run(Vm *machine, Instr *IP) {
+	vm = machine;
 	Val v;
 	int iArg, iTop, iBefore;
 	double fTop, fBefore;
@@ -148,101 +227,295 @@ void run(Instr *IP) {
 	void (*extFnPtr)();
 	for (;;) {
 		// shows the index of the current instruction and the number of values from stack
-		printf("%p/%d\t", IP, (int)(SP - stack + 1));
+		TRACE("%p/%d\t", IP, (int)(vm->SP - vm->stack + 1));
 		switch (IP->op) {
 			case OP_HALT:
-				printf("HALT");
+				TRACE("HALT");
 				return;
 			case OP_PUSH_I:
-				printf("PUSH.i\t%d", IP->arg.i);
+				TRACE("PUSH.i\t%d", IP->arg.i);
 				pushi(IP->arg.i);
 				IP = IP->next;
 				break;
 			case OP_CALL:
+				SPEND();
 				pushp(IP->next);
-				printf("CALL\t%p", IP->arg.instr);
+				TRACE("CALL\t%p", IP->arg.instr);
 				IP = IP->arg.instr;
 				break;
 			case OP_CALL_EXT:
+				if (vm->sandbox) {
+					err("Run: an extern function cannot be called in a sandbox");
+				}
 				extFnPtr = IP->arg.extFnPtr;
-				printf("CALL_EXT\t%p\n", extFnPtr);
+				TRACE("CALL_EXT\t%p\n", extFnPtr);
 				extFnPtr();
+				if (!vm->trace) {
+					// the output of the function is on its own line
+					fputc('\n', vm->out);
+				}
 				IP = IP->next;
 				break;
 			case OP_ENTER:
-				pushp(FP);
-				FP = SP;
-				SP += IP->arg.i;
-				printf("ENTER\t%d", IP->arg.i);
+				pushp(vm->FP);
+				vm->FP = vm->SP;
+				vm->SP += IP->arg.i;
+				if (vm->SP >= vm->stack + MAXSTACK) {
+					err("Trying to push into a full stack");
+				}
+				TRACE("ENTER\t%d", IP->arg.i);
 				IP = IP->next;
 				break;
+			case OP_RET:
+				v = popv();
+				iArg = IP->arg.i;
+				TRACE("RET\t%d\t// i:%d, f:%g", iArg, v.i, v.f);
+				IP = vm->FP[-1].p;
+				vm->SP = vm->FP - iArg - 2;
+				vm->FP = vm->FP[0].p;
+				pushv(v);
+				break;
 			case OP_RET_VOID:
 				iArg = IP->arg.i;
-				printf("RET_VOID\t%d", iArg);
-				IP = FP[-1].p;
-				SP = FP - iArg - 2;
-				FP = FP[0].p;
+				TRACE("RET_VOID\t%d", iArg);
+				IP = vm->FP[-1].p;
+				vm->SP = vm->FP - iArg - 2;
+				vm->FP = vm->FP[0].p;
 				break;
 			case OP_JMP:
-				printf("JMP\t%p", IP->arg.instr);
+				SPEND();
+				TRACE("JMP\t%p", IP->arg.instr);
 				IP = IP->arg.instr;
 				break;
 			case OP_JF:
+				SPEND();
 				iTop = popi();
-				printf("JF\t%p\t// %d", IP->arg.instr, iTop);
+				TRACE("JF\t%p\t// %d", IP->arg.instr, iTop);
 				IP = iTop ? IP->next : IP->arg.instr;
 				break;
+			case OP_JT:
+				SPEND();
+				iTop = popi();
+				TRACE("JT\t%p\t// %d", IP->arg.instr, iTop);
+				IP = iTop ? IP->arg.instr : IP->next;
+				break;
 			case OP_FPLOAD:
-				v = FP[IP->arg.i];
+				v = vm->FP[IP->arg.i];
 				pushv(v);
-				printf("FPLOAD\t%d\t// i:%d, f:%g", IP->arg.i, v.i, v.f);
+				TRACE("FPLOAD\t%d\t// i:%d, f:%g", IP->arg.i, v.i, v.f);
 				IP = IP->next;
 				break;
 			case OP_FPSTORE:
 				v = popv();
-				FP[IP->arg.i] = v;
-				printf("FPSTORE\t%d\t// i:%d, f:%g", IP->arg.i, v.i, v.f);
+				vm->FP[IP->arg.i] = v;
+				TRACE("FPSTORE\t%d\t// i:%d, f:%g", IP->arg.i, v.i, v.f);
 				IP = IP->next;
 				break;
-			case OP_ADD_I:
+			// the int operations wrap around on overflow, like the constants folded by the parser
+			case OP_ADD_I: BINARY_I("ADD.i", "+", (int) ((unsigned) iBefore + (unsigned) iTop))
+			case OP_SUB_I: BINARY_I("SUB.i", "-", (int) ((unsigned) iBefore - (unsigned) iTop))
+			case OP_MUL_I: BINARY_I("MUL.i", "*", (int) ((unsigned) iBefore * (unsigned) iTop))
+			case OP_DIV_I:
+				if (vm->SP->i == 0) {
+					err("Run: division by zero");
+				}
+				if (vm->SP->i == -1 && vm->SP[-1].i == INT_MIN) {
+					err("Run: the result of the division is too big");
+				}
+				BINARY_I("DIV.i", "/", iBefore / iTop)
+			case OP_LESS_I: BINARY_I("LESS.i", "<", iBefore < iTop)
+			case OP_LESSEQ_I: BINARY_I("LESSEQ.i", "<=", iBefore <= iTop)
+			case OP_GREATER_I: BINARY_I("GREATER.i", ">", iBefore > iTop)
+			case OP_GREATEREQ_I: BINARY_I("GREATEREQ.i", ">=", iBefore >= iTop)
+			case OP_EQUAL_I: BINARY_I("EQUAL.i", "==", iBefore == iTop)
+			case OP_NOTEQ_I: BINARY_I("NOTEQ.i", "!=", iBefore != iTop)
+			case OP_ADD_F: BINARY_F("ADD.f", "+", fBefore + fTop)
+			case OP_SUB_F: BINARY_F("SUB.f", "-", fBefore - fTop)
+			case OP_MUL_F: BINARY_F("MUL.f", "*", fBefore * fTop)
+			case OP_DIV_F: BINARY_F("DIV.f", "/", fBefore / fTop)
+			case OP_LESS_F: COMPARE_F("LESS.f", "<", fBefore < fTop)
+			case OP_LESSEQ_F: COMPARE_F("LESSEQ.f", "<=", fBefore <= fTop)
+			case OP_GREATER_F: COMPARE_F("GREATER.f", ">", fBefore > fTop)
+			case OP_GREATEREQ_F: COMPARE_F("GREATEREQ.f", ">=", fBefore >= fTop)
+			case OP_EQUAL_F: COMPARE_F("EQUAL.f", "==", fBefore == fTop)
+			case OP_NOTEQ_F: COMPARE_F("NOTEQ.f", "!=", fBefore != fTop)
+			case OP_PUSH_F:
+				TRACE("PUSH.f\t%g", IP->arg.f);
+				pushf(IP->arg.f);
+				IP = IP->next;
+				break;
+			case OP_NEG_I:
 				iTop = popi();
-				iBefore = popi();
-				pushi(iBefore + iTop);
-				printf("ADD.i\t// %d+%d -> %d", iBefore, iTop, iBefore + iTop);
+				iArg = (int) (0u - (unsigned) iTop);
+				pushi(iArg);
+				TRACE("NEG.i\t// %d -> %d", iTop, iArg);
+				IP = IP->next;
+				break;
+			case OP_NEG_F:
+				fTop = popf();
+				pushf(-fTop);
+				TRACE("NEG.f\t// %g -> %g", fTop, -fTop);
 				IP = IP->next;
 				break;
-			case OP_LESS_I:
+			case OP_NOT_I:
 				iTop = popi();
-				iBefore = popi();
-				pushi(iBefore < iTop);
-				printf("LESS.i\t// %d<%d -> %d", iBefore, iTop, iBefore < iTop);
+				pushi(!iTop);
+				TRACE("NOT.i\t// %d -> %d", iTop, !iTop);
 				IP = IP->next;
 				break;
-
-			case OP_LESS_F:
+			case OP_NOT_F:
 				fTop = popf();
-				fBefore = popf();
-				pushi(fBefore < fTop);
-				printf("LESS.f\t// %g<%g -> %d", fBefore, fTop, fBefore < fTop);
+				pushi(!fTop);
+				TRACE("NOT.f\t// %g -> %d", fTop, !fTop);
+				IP = IP->next;
+				break;
+			case OP_CONV_I_F:
+				iTop = popi();
+				pushf(iTop);
+				TRACE("CONV.i.f\t// %d -> %g", iTop, (double) iTop);
 				IP = IP->next;
 				break;
-			case OP_ADD_F:
+			case OP_CONV_F_I:
 				fTop = popf();
-				fBefore = popf();
-				pushf(fBefore + fTop);
-				printf("ADD.f\t// %g+%g -> %g", fBefore, fTop, fBefore + fTop);
+				pushi((int) fTop);
+				TRACE("CONV.f.i\t// %g -> %d", fTop, (int) fTop);
 				IP = IP->next;
 				break;
-			case OP_PUSH_F:
-				printf("PUSH.f\t%g", IP->arg.f);
-				pushf(IP->arg.f);
+			case OP_CONV_I_C:
+				iTop = popi();
+				pushi((char) iTop);
+				TRACE("CONV.i.c\t// %d -> %d", iTop, (char) iTop);
+				IP = IP->next;
+				break;
+			case OP_FPADDR:
+				pushp(vm->FP + IP->arg.i);
+				TRACE("FPADDR\t%d\t// %p", IP->arg.i, (void*) (vm->FP + IP->arg.i));
+				IP = IP->next;
+				break;
+			case OP_ADDR:
+				if (vm->sandbox) {
+					err("Run: the memory outside the stack cannot be used in a sandbox");
+				}
+				pushp(IP->arg.p);
+				TRACE("ADDR\t%p", IP->arg.p);
+				IP = IP->next;
+				break;
+			case OP_GADDR:
+				if (vm->sandbox) {
+					err("Run: the memory outside the stack cannot be used in a sandbox");
+				}
+				pushp(vm->globals + IP->arg.i);
+				TRACE("GADDR\t%d\t// %p", IP->arg.i, (void*) (vm->globals + IP->arg.i));
 				IP = IP->next;
 				break;
+			// the values in memory can be unaligned, so they are copied
+			case OP_LOAD_I:
+				pTop = popp();
+				CHECK_MEM(pTop, sizeof(int));
+				memcpy(&iTop, pTop, sizeof(int));
+				pushi(iTop);
+				TRACE("LOAD.i\t// *%p -> %d", pTop, iTop);
+				IP = IP->next;
+				break;
+			case OP_LOAD_F:
+				pTop = popp();
+				CHECK_MEM(pTop, sizeof(double));
+				memcpy(&fTop, pTop, sizeof(double));
+				pushf(fTop);
+				TRACE("LOAD.f\t// *%p -> %g", pTop, fTop);
+				IP = IP->next;
+				break;
+			case OP_LOAD_C:
+				pTop = popp();
+				CHECK_MEM(pTop, sizeof(char));
+				pushi(*(char*) pTop);
+				TRACE("LOAD.c\t// *%p -> %d", pTop, *(char*) pTop);
+				IP = IP->next;
+				break;
+			case OP_STORE_I:
+				pTop = popp();
+				iTop = popi();
+				CHECK_MEM(pTop, sizeof(int));
+				memcpy(pTop, &iTop, sizeof(int));
+				TRACE("STORE.i\t// *%p = %d", pTop, iTop);
+				IP = IP->next;
+				break;
+			case OP_STORE_F:
+				pTop = popp();
+				fTop = popf();
+				CHECK_MEM(pTop, sizeof(double));
+				memcpy(pTop, &fTop, sizeof(double));
+				TRACE("STORE.f\t// *%p = %g", pTop, fTop);
+				IP = IP->next;
+				break;
+			case OP_STORE_C:
+				pTop = popp();
+				iTop = popi();
+				CHECK_MEM(pTop, sizeof(char));
+				*(char*) pTop = (char) iTop;
+				TRACE("STORE.c\t// *%p = %d", pTop, iTop);
+				IP = IP->next;
+				break;
+			case OP_STORE_S:
+				pTop = popp();
+				v = popv();
+				CHECK_MEM(pTop, IP->arg.i);
+				CHECK_MEM(v.p, IP->arg.i);
+				memmove(pTop, v.p, IP->arg.i);
+				TRACE("STORE.s\t%d\t// *%p = *%p", IP->arg.i, pTop, v.p);
+				IP = IP->next;
+				break;
+			case OP_INDEX:
+				iTop = popi();
+				pTop = (char*) popp() + (ptrdiff_t) iTop * IP->arg.i;
+				pushp(pTop);
+				TRACE("INDEX\t%d\t// [%d] -> %p", IP->arg.i, iTop, pTop);
+				IP = IP->next;
+				break;
+			case OP_OFFSET:
+				pTop = (char*) popp() + IP->arg.i;
+				pushp(pTop);
+				TRACE("OFFSET\t%d\t// -> %p", IP->arg.i, pTop);
+				IP = IP->next;
+				break;
+			case OP_COPY:
+				pTop = popp();
+				CHECK_MEM(pTop, IP->arg.i);
+				iArg = (IP->arg.i + sizeof(Val) - 1) / sizeof(Val);
+				if (vm->SP + iArg >= vm->stack + MAXSTACK) {
+					err("Trying to push into a full stack");
+				}
+				memcpy(vm->SP + 1, pTop, IP->arg.i);
+				vm->SP += iArg;
+				TRACE("COPY\t%d\t// from %p", IP->arg.i, pTop);
+				IP = IP->next;
+				break;
+			case OP_DUP:
+				v = *vm->SP;
+				pushv(v);
+				TRACE("DUP\t// i:%d, f:%g", v.i, v.f);
+				IP = IP->next;
+				break;
+			case OP_DROP:
+				v = popv();
+				TRACE("DROP\t// i:%d, f:%g", v.i, v.f);
+				IP = IP->next;
+				break;
+			case OP_LAZY:
+				if (!vm->genLazy || vm->sandbox) {
+					err("Run: the function is not generated");
+				}
+				TRACE("LAZY\t%p", IP->arg.p);
+				vm->genLazy(IP->arg.p);
+				// the generation can run other machines, to evaluate its calls
+				vm = machine;
+				// IP is now the OP_ENTER of the function
+				break;
 			
 			default:
 				err("Run: instruction not implemented: %d", IP->op);
 		}
-		putchar('\n');
+		TRACE("\n");
 	}
 }
 
@@ -272,7 +545,7 @@ Instr *genTestProgram() {
 	Instr *jfAfter = addInstr(&code, OP_JF);
 	// put_i(i);
 	addInstrWithInt(&code, OP_FPLOAD, 1);
-	Symbol *s = findSymbol("put_i");
+	Symbol *s = findSymbol(atomGet("put_i"));
 	if (!s) {
 		err("Undefined: put_i");
 	}
@@ -315,7 +588,7 @@ Instr *genTestProgram2() {
 	Instr *jfAfter = addInstr(&code, OP_JF);
 	// put_d(i);
 	addInstrWithInt(&code, OP_FPLOAD, 1);
-	Symbol *s = findSymbol("put_d");
+	Symbol *s = findSymbol(atomGet("put_d"));
 	if (!s) {
 		err("Undefined: put_d");
 	}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "doc.h"
+
+// latency of an edit in a document, compared with the analysis of the whole document, for growing sizes
+
+#define NUM_EDITS 200
+
+// a source with n functions, each one using the previous one
+static char *genSource(int n, int *len) {
+	char *buf = safeAlloc((size_t) n * 128 + 64);
+	int k = sprintf(buf, "int total;\n");
+	for (int i = 0; i < n; ++i) {
+		if (i == 0) {
+			k += sprintf(buf + k, "int f0(int x){\n\treturn x+1;\n\t}\n");
+		} else {
+			k += sprintf(buf + k, "int f%d(int x){\n\ttotal=total+x;\n\treturn f%d(x-1);\n\t}\n", i, i - 1);
+		}
+	}
+	*len = k;
+	return buf;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+	types a char in a statement of the middle function and deletes it, then the same with a syntax error
+	the first edit moves the gaps of the document from its end to that function, so it is timed alone
+*/
+static void bench(int nFns) {
+	int len;
+	char *src = genSource(nFns, &len);
+	double start = now();
+	Doc *doc = docOpen(src, len);
+	double tOpen = now() - start;
+	char name[32];
+	sprintf(name, "int f%d(", nFns / 2);
+	int pos = (int) (strstr(src, name) - src);
+	pos = (int) (strstr(src + pos, "x-1") - src) + 1;
+	const Diagnostic *diags;
+	start = now();
+	docEdit(doc, pos, pos, " ", 1);
+	docDiagnostics(doc, &diags);
+	double tFirst = now() - start;
+	docEdit(doc, pos, pos + 1, "", 0);
+	int nDiags = 0;
+	double tEdit = 0, tError = 0;
+	for (int i = 0; i < NUM_EDITS; ++i) {
+		start = now();
+		docEdit(doc, pos, pos, "2", 1);	// x2-1
+		docDiagnostics(doc, &diags);
+		docEdit(doc, pos, pos + 1, "", 0);
+		docDiagnostics(doc, &diags);
+		tEdit += now() - start;
+		start = now();
+		docEdit(doc, pos, pos, "+", 1);	// x+-1 is correct, x+)... is not
+		docEdit(doc, pos + 1, pos + 1, ")", 1);
+		nDiags = docDiagnostics(doc, &diags);
+		docEdit(doc, pos, pos + 2, "", 0);
+		docDiagnostics(doc, &diags);
+		tError += now() - start;
+	}
+	printf("%6d functions %8d chars  open %8.2f ms  first edit %7.3f ms  edit %7.3f ms  edit with error %7.3f ms  (%d diagnostic)\n",
+		nFns, len, tOpen * 1e3, tFirst * 1e3, tEdit / (2 * NUM_EDITS) * 1e3, tError / (4 * NUM_EDITS) * 1e3, nDiags);
+	docClose(doc);
+	free(src);
+}
+
+int main() {
+	for (int n = 1000; n <= 16000; n *= 4) {
+		bench(n);
+	}
+	freeTypes();
+	freeAtoms();
+	return 0;
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "compiler.h"
+
+// compilation time of a program made from many generated files, with a growing number of threads,
+// then of the same functions in a single file
+// the bodies of the functions are built by all the threads, so a single file scales like many files
+// the lazy mode builds only the bodies which are used, so its time depends on them, not on the size of the file
+// a file which imports the interface of the other ones compiles only its own declarations and bodies
+
+#define NUM_FILES 16
+#define FNS_PER_FILE 250
+#define NUM_RUNS 3
+#define MAX_THREADS 8
+
+// a file with functions which call the functions of the next file
+static char *genFile(int file) {
+	char *buf = safeAlloc(FNS_PER_FILE * 256 + 64);
+	size_t n = 0;
+	if (file == 0) {
+		n += sprintf(buf + n, "struct Acc{ int n; double sum; };\n");
+	}
+	for (int k = 0; k < FNS_PER_FILE; ++k) {
+		n += sprintf(buf + n, "double f%d_%d(int x){\n\tstruct Acc a;\n\ta.n = 0;\n\ta.sum = 0;\n"
+			"\twhile (a.n < x) {\n\t\ta.sum = a.sum + a.n * 0.5;\n\t\ta.n = a.n + 1;\n\t}\n"
+			"\tif (x > 0) return a.sum + f%d_%d(x - 1);\n\treturn a.sum;\n}\n", file, k, (file + 1) % NUM_FILES, k);
+	}
+	return buf;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench(int nFiles, char **files) {
+	const char *names[NUM_FILES];
+	for (int i = 0; i < nFiles; ++i) {
+		names[i] = "generated";
+	}
+	for (int nThreads = 1; nThreads <= MAX_THREADS; nThreads *= 2) {
+		double best = 1e9;
+		for (int run = 0; run < NUM_RUNS; ++run) {
+			double start = now();
+			Compiler *c = newCompiler(stdout);
+			if (!compileFiles(c, nFiles, names, (const char**) files, nThreads)) {
+				err("%s", c->errors[0].msg);
+			}
+			freeCompiler(c);
+			double t = now() - start;
+			if (t < best) {
+				best = t;
+			}
+		}
+		printf("%2d file%s %d thread%s %10.1f ms\n", nFiles, nFiles == 1 ? ", " : "s,", nThreads, nThreads == 1 ? " " : "s", best * 1e3);
+	}
+}
+
+// a lazy compilation of the file, then the build of one of its functions
+static void benchLazy(char *text) {
+	const char *name = "generated";
+	double best = 1e9;
+	for (int run = 0; run < NUM_RUNS; ++run) {
+		double start = now();
+		Compiler *c = newCompiler(stdout);
+		c->lazy = true;
+		if (!compileFiles(c, 1, &name, (const char**) &text, 1) || !compileFn(c, "f0_0")) {
+			err("%s", c->errors[0].msg);
+		}
+		freeCompiler(c);
+		double t = now() - start;
+		if (t < best) {
+			best = t;
+		}
+	}
+	printf(" 1 file,  lazy      %10.1f ms\n", best * 1e3);
+}
+
+// the compilation of the first file, with the other files imported from their module interface
+static void benchModule(char **files) {
+	const char *path = "bench_files.atm";
+	const char *names[NUM_FILES];
+	for (int i = 0; i < NUM_FILES; ++i) {
+		names[i] = "generated";
+	}
+	// the bodies of the module call the functions of the first file, so they are not built here
+	Compiler *c = newCompiler(stdout);
+	c->lazy = true;
+	if (!compileFiles(c, NUM_FILES - 1, names + 1, (const char**) files + 1, 1) || !writeModule(c, path)) {
+		err("%s", c->errors[0].msg);
+	}
+	freeCompiler(c);
+	double best = 1e9;
+	for (int run = 0; run < NUM_RUNS; ++run) {
+		double start = now();
+		c = newCompiler(stdout);
+		if (!importModule(c, path) || !compileFiles(c, 1, names, (const char**) files, 1)) {
+			err("%s", c->errors[0].msg);
+		}
+		freeCompiler(c);
+		double t = now() - start;
+		if (t < best) {
+			best = t;
+		}
+	}
+	remove(path);
+	printf(" 1 file,  module    %10.1f ms\n", best * 1e3);
+}
+
+int main() {
+	char *files[NUM_FILES];
+	size_t len = 0;
+	for (int i = 0; i < NUM_FILES; ++i) {
+		files[i] = genFile(i);
+		len += strlen(files[i]);
+	}
+	bench(NUM_FILES, files);
+	char *all = safeAlloc(len + 1);
+	all[0] = '\0';
+	for (int i = 0, n = 0; i < NUM_FILES; ++i) {
+		n += sprintf(all + n, "%s", files[i]);
+	}
+	bench(1, &all);
+	benchLazy(all);
+	benchModule(files);
+	free(all);
+	for (int i = 0; i < NUM_FILES; ++i) {
+		free(files[i]);
+	}
+	freeTypes();
+	freeAtoms();
+	return 0;
+}
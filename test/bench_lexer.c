@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "lexer.h"
+#include "scan.h"
+
+// lexer throughput on generated inputs, for each kind of scanning kernels supported by the CPU
+// and for the parallel lexer with a growing number of threads
+
+#define INPUT_SIZE (32 * 1024 * 1024)
+#define NUM_RUNS 5
+#define MAX_THREADS 8
+
+// fills a buffer of about INPUT_SIZE chars by repeating the given line generator
+static char *genInput(void (*genLine)(char *line, int i)) {
+	char *buf = safeAlloc(INPUT_SIZE + 256);
+	size_t n = 0;
+	char line[256];
+	for (int i = 0; n < INPUT_SIZE; ++i) {
+		genLine(line, i);
+		size_t len = strlen(line);
+		memcpy(buf + n, line, len);
+		n += len;
+	}
+	buf[n] = '\0';
+	return buf;
+}
+
+static void commentLine(char *line, int i) {
+	if (i % 4 == 0) {
+		sprintf(line, "\tint value%d;\n", i % 100);
+	} else {
+		sprintf(line, "\t// the comment number %d explains in many words what the next declaration is used for\n", i);
+	}
+}
+
+static void identifierLine(char *line, int i) {
+	sprintf(line, "\tcurrent_accumulated_total_%d = previous_accumulated_total_%d + element_weight_factor_%d;\n", i % 512, (i + 1) % 512, i % 64);
+}
+
+static void numberLine(char *line, int i) {
+	sprintf(line, "\t%d, %d.%d, %de-%d, %d, %d.%de%d,\n", i, i % 1000, i % 97, i % 89 + 1, i % 17, i * 7, i % 31, i % 1009, i % 23);
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench(const char *name, const char *input) {
+	size_t len = strlen(input);
+	for (ScanLevel level = SCAN_SCALAR; level <= SCAN_AVX2; ++level) {
+		if (!scanSupported(level)) {
+			continue;
+		}
+		scanUse(level);
+		double best = 1e9;
+		int n = 0;
+		for (int run = 0; run < NUM_RUNS; ++run) {
+			double start = now();
+			Tokens *tokens = tokenize(input);
+			double t = now() - start;
+			n = tokens->n;
+			freeTokens(tokens);
+			if (t < best) {
+				best = t;
+			}
+		}
+		printf("%-12s %-8s %8.1f MB/s  (%d tokens)\n", name, scanLevelName(level), len / best / (1024 * 1024), n);
+	}
+}
+
+static void benchParallel(const char *name, const char *input) {
+	size_t len = strlen(input);
+	for (int nThreads = 1; nThreads <= MAX_THREADS; nThreads *= 2) {
+		double best = 1e9;
+		int n = 0;
+		for (int run = 0; run < NUM_RUNS; ++run) {
+			double start = now();
+			Tokens *tokens = tokenizeParallel(input, len, nThreads);
+			double t = now() - start;
+			n = tokens->n;
+			freeTokens(tokens);
+			if (t < best) {
+				best = t;
+			}
+		}
+		printf("%-12s %d thread%s %8.1f MB/s  (%d tokens)\n", name, nThreads, nThreads == 1 ? " " : "s", len / best / (1024 * 1024), n);
+	}
+}
+
+int main() {
+	char *comments = genInput(commentLine);
+	char *identifiers = genInput(identifierLine);
+	char *numbers = genInput(numberLine);
+	bench("comments", comments);
+	bench("identifiers", identifiers);
+	bench("numbers", numbers);
+	benchParallel("comments", comments);
+	benchParallel("identifiers", identifiers);
+	free(comments);
+	free(identifiers);
+	free(numbers);
+	freeAtoms();
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "lexer.h"
+#include "parser.h"
+#include "ad.h"
+
+// parsing time of deeply nested expressions, for a growing nesting depth
+// with a linear time parser the time per nesting level stays the same
+
+#define MIN_DEPTH 64
+#define MAX_DEPTH 4096
+#define NUM_RUNS 20
+
+// a function with an expression nested depth times, made from the prefix and the suffix of each level
+static char *genSource(const char *prefix, const char *suffix, int depth) {
+	size_t lenPrefix = strlen(prefix), lenSuffix = strlen(suffix);
+	char *buf = safeAlloc(depth * (lenPrefix + lenSuffix) + 64);
+	size_t n = sprintf(buf, "void f(){\n\tint x;\n\tx=");
+	for (int i = 0; i < depth; ++i) {
+		memcpy(buf + n, prefix, lenPrefix);
+		n += lenPrefix;
+	}
+	buf[n++] = 'x';
+	for (int i = 0; i < depth; ++i) {
+		memcpy(buf + n, suffix, lenSuffix);
+		n += lenSuffix;
+	}
+	strcpy(buf + n, ";\n}\n");
+	return buf;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench(const char *name, const char *prefix, const char *suffix) {
+	for (int depth = MIN_DEPTH; depth <= MAX_DEPTH; depth *= 2) {
+		char *src = genSource(prefix, suffix, depth);
+		Tokens *tokens = tokenize(src);
+		Ast ast;
+		astInit(&ast);
+		double best = 1e9;
+		for (int run = 0; run < NUM_RUNS; ++run) {
+			double start = now();
+			astClear(&ast);
+			pushDomain();
+			for (int idx = 0; tkCode(tokens, idx) != END; ) {
+				idx = parseTopLevel(tokens, idx, &ast);
+			}
+			dropDomain();
+			double t = now() - start;
+			if (t < best) {
+				best = t;
+			}
+		}
+		printf("%-12s depth %5d %10.1f us  %6.1f ns/level\n", name, depth, best * 1e6, best * 1e9 / depth);
+		astFree(&ast);
+		freeTokens(tokens);
+		free(src);
+	}
+}
+
+int main() {
+	bench("parentheses", "(", ")");
+	bench("negations", "-(", ")");
+	bench("assignments", "(x=", ")");
+	bench("operators", "(x+", ")*x");
+	bench("casts", "(double)-(", ")");
+	parseEnd();
+	freeTypes();
+	freeAtoms();
+	return 0;
+}
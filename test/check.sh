@@ -0,0 +1,51 @@
+#!/bin/sh
+# runs the samples and compares their output (stdout and stderr) with the expected one, from test/samples/rezultat-*.txt
+# run from the root of the project, after make
+
+MAIN=./test/main
+SAMPLES=test/samples
+OUT=test/check_output.txt
+failed=0
+
+# check <expected> <args of the driver>...
+check() {
+	expected=$SAMPLES/$1
+	shift
+	$MAIN "$@" > $OUT 2>&1
+	if diff -u $expected $OUT; then
+		echo "ok      $expected"
+	else
+		echo "FAILED  $expected"
+		failed=1
+	fi
+}
+
+# the code of locals, params, globals, if/while, the short-circuit of && and ||, calls, returns and conversions
+check rezultat-testgc.txt $SAMPLES/testgc.c
+
+# the calls with constant arguments, evaluated at compile time or left for the run
+check rezultat-testfold.txt $SAMPLES/testfold.c
+
+# programs made from many files
+check rezultat-multi.txt $SAMPLES/multi/a.c $SAMPLES/multi/b.c
+check rezultat-redef.txt $SAMPLES/redef/a.c $SAMPLES/redef/b.c
+
+# a module interface, imported by a program
+LIB=test/testmodlib.atm
+check rezultat-testmodlib.txt -w $LIB $SAMPLES/testmodlib.c
+check rezultat-testmodmain.txt -i $LIB $SAMPLES/testmodmain.c
+# the interface is damaged: it ends before its text
+head -c 100 $LIB > test/damaged.atm
+check rezultat-testmoddamaged.txt -i test/damaged.atm $SAMPLES/testmodmain.c
+# the extern function put_i needed by the module returns int instead of void: the tb of its record, the first one, is TB_INT
+cp $LIB test/mismatch.atm
+printf '\000' | dd of=test/mismatch.atm bs=1 seek=21 conv=notrunc 2>/dev/null
+check rezultat-testmodmismatch.txt -i test/mismatch.atm $SAMPLES/testmodmain.c
+rm -f $LIB test/damaged.atm test/mismatch.atm
+
+# the lazy mode checks only the bodies of the called functions, when they are called; the other mode checks all of them
+check rezultat-testlazy.txt -l $SAMPLES/testlazy.c
+check rezultat-testlazy-eager.txt $SAMPLES/testlazy.c
+
+rm -f $OUT test/global_domain.txt test/token_list.txt
+exit $failed
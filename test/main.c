@@ -1,32 +1,125 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 
 #include "utils.h"
 #include "lexer.h"
 #include "parser.h"
+#include "ast.h"
 #include "ad.h"
 #include "vm.h"
+#include "gc.h"
+#include "compiler.h"
 
 #define TOKEN_LIST_FILE "test/token_list.txt"
 #define GLOBAL_DOMAIN_FILE "test/global_domain.txt"
+#define AST_FILE "test/ast.txt"
 #define VM_RUN_FILE "test/vm_run.txt"
 
+// the options of a program made from many files
+typedef struct {
+    bool lazy;              // -l: the function bodies are built on their first call
+    const char **imports;   // -i <interface>: the module interfaces imported before the files
+    int nImports;
+    const char *write;      // -w <interface>: the file where the interface of the program is written
+} ProgramOptions;
+
+// compiles the files as a single program, shows its global domain and runs it
+static int compileProgram(int nFiles, char **files, ProgramOptions *opts) {
+    Source **srcs = safeAlloc(nFiles * sizeof(Source*));
+    const char **texts = safeAlloc(nFiles * sizeof(const char*));
+    for (int i = 0; i < nFiles; ++i) {
+        srcs[i] = loadSource(files[i]);
+        texts[i] = srcs[i]->text;
+    }
+
+    Compiler *c = newCompiler(stdout);
+    c->lazy = opts->lazy;
+    bool ok = true;
+    for (int i = 0; ok && i < opts->nImports; ++i) {
+        ok = importModule(c, opts->imports[i]);
+    }
+    ok = ok && compileFiles(c, nFiles, (const char**) files, texts, 0);
+    if (ok) {
+        printf("Syntax ok\n");
+        FILE *global_domain_stream = createOutputStream(GLOBAL_DOMAIN_FILE);
+        showDomain(c->global, "global", global_domain_stream);
+        fclose(global_domain_stream);
+        if (opts->write) {
+            ok = writeModule(c, opts->write);
+        }
+        if (ok && findSymbolInDomain(c->global, atomGet("main"))) {
+            ok = runMain(c);
+        }
+    }
+    // the errors are shown after the output of the program
+    fflush(stdout);
+    for (int k = 0; k < c->nErrors; ++k) {
+        CompileError *e = &c->errors[k];
+        if (e->file) {
+            fprintf(stderr, "%s: ", e->file);
+        }
+        if (e->line) {
+            fprintf(stderr, "Error at line %d: %s\n", e->line, e->msg);
+        } else {
+            fprintf(stderr, "Error: %s\n", e->msg);
+        }
+    }
+
+    freeCompiler(c);
+    for (int i = 0; i < nFiles; ++i) {
+        freeSource(srcs[i]);
+    }
+    free(srcs);
+    free(texts);
+    free(opts->imports);
+    freeTypes();
+    freeAtoms();
+    return ok ? 0 : EXIT_FAILURE;
+}
+
 int main(int argc, char **argv) {
 
-    if (argc != 2) {
-        err("Usage: %s <source_file.atomc>", argv[0]);
+    // -s: the parser pulls the tokens from a stream instead of a fully tokenized file
+    bool stream = argc == 3 && !strcmp(argv[1], "-s");
+
+    // the options of a program are before its files
+    ProgramOptions opts = { false, safeAlloc(argc * sizeof(const char*)), 0, NULL };
+    int first = 1;
+    for (; first < argc && !stream && argv[first][0] == '-'; ++first) {
+        if (!strcmp(argv[first], "-l")) {
+            opts.lazy = true;
+        } else if (!strcmp(argv[first], "-i") && first + 1 < argc) {
+            opts.imports[opts.nImports++] = argv[++first];
+        } else if (!strcmp(argv[first], "-w") && first + 1 < argc) {
+            opts.write = argv[++first];
+        } else {
+            break;
+        }
+    }
+    if (first < argc && (first > 1 || argc - first > 1) && !stream) {
+        return compileProgram(argc - first, argv + first, &opts);
+    }
+    free(opts.imports);
+    if (!stream && (argc != 2 || first > 1)) {
+        err("Usage: %s [-s] <source_file.atomc> | [-l] [-i <interface>]... [-w <interface>] <source_file.atomc>...", argv[0]);
     }
 
     // Load source file and create output streams
-    char *file_buf = loadFile(argv[1]);
-    FILE *token_list_stream = createOutputStream(TOKEN_LIST_FILE);
+    Source *src = loadSource(argv[argc - 1]);
     FILE *global_domain_stream = createOutputStream(GLOBAL_DOMAIN_FILE);
 
-    // Run lexer
-    Token *tokens = tokenize(file_buf);
-    free(file_buf);
-    showTokens(tokens, token_list_stream);
-    fclose(token_list_stream);
+    // Run lexer (when streaming, the lexer runs on demand during parsing)
+    Tokens *tokens;
+    if (stream) {
+        tokens = openTokenStream(src->text);
+    } else {
+        FILE *token_list_stream = createOutputStream(TOKEN_LIST_FILE);
+        tokens = tokenizeParallel(src->text, src->len, 0);
+        showTokens(tokens, token_list_stream);
+        fclose(token_list_stream);
+    }
 
     // Create global domain
     pushDomain();
@@ -35,21 +128,49 @@ int main(int argc, char **argv) {
     vmInit(); 
 
     // Run parser
-    parse(tokens);
+    Ast ast;
+    astInit(&ast);
+    parse(tokens, &ast);
+
+    // Generate the code of the functions
+    genCode(&ast);
+
+    // Show the syntax tree
+    FILE *ast_stream = createOutputStream(AST_FILE);
+    showAst(&ast, ast_stream);
+    fclose(ast_stream);
 
     // Show global domain
     showDomain(symTable, "global", global_domain_stream);
     fclose(global_domain_stream);
 
     // Test VM
+    Vm *vm = newVm(stdout);
+    vmGlobals(vm, symTable->dataSize);
+    vm->trace = true;
     Instr *testProgram = genTestProgram2();
     redirectStdoutToFile(VM_RUN_FILE);
-    run(testProgram);
+    run(vm, testProgram);
     restoreStdout();
+    freeInstrs(testProgram);
+
+    // Run the program, if it has a main function
+    Symbol *mainFn = findSymbol(atomGet("main"));
+    if (mainFn && mainFn->kind == SK_FN && mainFn->fn.instr) {
+        vm->trace = false;
+        Instr *program = genProgram(mainFn);
+        run(vm, program);
+        freeInstrs(program);
+    }
+    freeVm(vm);
 
     // Cleanup memory
+    astFree(&ast);
     dropDomain();
     freeTokens(tokens);
+    freeTypes();
+    freeAtoms();
+    freeSource(src);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,15 @@
+// the first file of a program made from a.c and b.c
+
+struct Range{
+	int from;
+	int to;
+	};
+
+int length(struct Range r[]){
+	return r[0].to-r[0].from;
+	}
+
+// it calls a function of b.c: the bodies can use the declarations of all the files
+int lengthTwice(struct Range r[]){
+	return twice(length(r));
+	}
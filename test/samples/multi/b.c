@@ -0,0 +1,15 @@
+// the second file of a program made from a.c and b.c, which uses the struct and the functions of a.c
+
+struct Range all[1];
+
+int twice(int x){
+	return x*2;
+	}
+
+int main(){
+	all[0].from=3;
+	all[0].to=10;
+	put_i(length(all));
+	put_i(lengthTwice(all));
+	return 0;
+	}
@@ -0,0 +1,5 @@
+// b.c defines f again, so the link reports the redefinition at its line 1
+
+int f(){
+	return 1;
+	}
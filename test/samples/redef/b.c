@@ -0,0 +1,8 @@
+int f(){
+	return 2;
+	}
+
+int main(){
+	put_i(f());
+	return 0;
+	}
@@ -0,0 +1,47 @@
+// calls with constant arguments, which the compiler tries to evaluate at compile time
+
+// a void function has no result, so its calls are not evaluated
+void nop(int x){
+	int y;
+	y=x*2;
+	}
+
+// the index is outside the array, so the call is left for the run
+int outside(int i){
+	int a[2];
+	a[i]=5;
+	return a[0];
+	}
+
+int twice(int x){
+	return x*2;
+	}
+
+// its loop needs more steps than the budget of an evaluation, so the call is left for the run
+int count(int n){
+	int i;
+	i=0;
+	while(i<n)i=i+1;
+	return i;
+	}
+
+// an extern function cannot be called by an evaluation, so the call is left for the run
+int shown(int x){
+	put_i(x);
+	return x+1;
+	}
+
+int main(){
+	int i;
+	i=0;
+	while(i<100000){
+		nop(3);
+		i=i+1;
+		}
+	put_i(i);
+	put_i(twice(21));
+	put_i(count(200000));
+	put_i(shown(5));
+	if(i<0)put_i(outside(100000));
+	return 0;
+	}
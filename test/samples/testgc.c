@@ -0,0 +1,55 @@
+// the code generated for the statements and the expressions of the functions
+
+int nCalls;
+
+// it shows its argument, so its calls can be seen
+int shown(int x){
+	nCalls=nCalls+1;
+	put_i(x);
+	return x;
+	}
+
+int sum(int n){
+	int i;
+	int s;
+	i=1;
+	s=0;
+	while(i<=n){
+		s=s+i;
+		i=i+1;
+		}
+	return s;
+	}
+
+int sign(int x){
+	if(x<0)return 0-1;
+	else if(x==0)return 0;
+	return 1;
+	}
+
+// the int argument and the int operands are converted to double
+double half(double x){
+	return x/2;
+	}
+
+int main(){
+	int k;
+	double d;
+	put_i(sum(10));
+	put_i(sign(0-5));
+	put_i(sign(0));
+	put_i(sign(7));
+	// the right operands are evaluated only if they are needed
+	if(shown(0)&&shown(1))put_i(100);
+	if(shown(2)||shown(3))put_i(200);
+	if(shown(4)&&shown(5))put_i(300);
+	if(shown(0)||shown(6))put_i(400);
+	put_i(nCalls);
+	k=5;
+	d=k;
+	put_d(d+half(k));
+	// the double is converted back to int
+	k=d*3;
+	put_i(k);
+	return 0;
+	}
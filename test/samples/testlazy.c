@@ -0,0 +1,23 @@
+// in the lazy mode (-l) a function body is built on its first call, so only the bodies which are called are checked
+
+// it is never called, so its error is not reported
+void unused(){
+	int a[3];
+	a=1;
+	}
+
+int twice(int x){
+	return x*2;
+	}
+
+// the error is reported when main calls it, after the calls before it were run
+int broken(int x){
+	int a[3];
+	return a+x;
+	}
+
+int main(){
+	put_i(twice(21));
+	put_i(broken(1));
+	return 0;
+	}
@@ -0,0 +1,20 @@
+// a module with a struct, a global variable and functions, which is imported by testmodmain.c
+
+struct Point{
+	int x;
+	int y;
+	};
+
+struct Point last;
+int nMoves;
+
+void move(int dx,int dy){
+	last.x=last.x+dx;
+	last.y=last.y+dy;
+	nMoves=nMoves+1;
+	}
+
+void show(){
+	put_i(last.x);
+	put_i(last.y);
+	}
@@ -0,0 +1,13 @@
+// a program which uses the struct, the global variables and the functions of the module testmodlib.c
+
+int main(){
+	struct Point p;
+	move(2,3);
+	move(4,0-1);
+	show();
+	p.x=last.x*10;
+	p.y=nMoves;
+	put_i(p.x);
+	put_i(p.y);
+	return 0;
+	}